@@ -0,0 +1,317 @@
+// collision microbenchmark. builds a synthetic scene of circles and
+// rectangles, runs the broadphase and the narrowphase of the collider over
+// it for a number of frames and prints the timings as a json object.
+//
+// arguments are name=value pairs, all optional:
+//   shapes=1000        number of shapes, one per object
+//   circles=0.5        fraction of the shapes that are circles
+//   layout=uniform     uniform or clustered positions
+//   motion=moving      moving or static shapes
+//   broadphase=sap     sap, tree or grid
+//   cellsize=32        cell size of the grid broadphase
+//   size=16            largest shape dimension
+//   frames=200         measured frames
+//   warmup=10          frames run before measuring
+//   seed=1             scene random seed
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "shapes.h"
+#include "sweepandprune.h"
+#include "spatialhash.h"
+#include "aabbtree.h"
+
+using namespace std;
+
+typedef chrono::steady_clock benchclock;
+
+// object of the scene, owner of the parameters of a single shape
+class benchobject : public component::base {
+  public:
+    virtual gear2d::component::family family() { return "bench"; }
+    virtual gear2d::component::type type() { return "bench"; }
+    virtual void setup(object::signature &) { }
+    virtual void update(timediff, int) { }
+};
+
+struct options {
+  int shapes;
+  float circles;
+  string layout;
+  string motion;
+  string broadphase;
+  float cellsize;
+  float size;
+  int frames;
+  int warmup;
+  unsigned int seed;
+  
+  options()
+  : shapes(1000), circles(0.5), layout("uniform"), motion("moving"), broadphase("sap"),
+    cellsize(32), size(16), frames(200), warmup(10), seed(1)
+  {
+  }
+  
+  // reads the name=value arguments. returns false on unknown names
+  bool parse(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+      string argument = argv[i];
+      size_t equal = argument.find('=');
+      if (equal == string::npos)
+        return false;
+      
+      string name = argument.substr(0, equal);
+      string value = argument.substr(equal + 1);
+      if (name == "shapes") shapes = eval<int>(value);
+      else if (name == "circles") circles = eval<float>(value);
+      else if (name == "layout") layout = value;
+      else if (name == "motion") motion = value;
+      else if (name == "broadphase") broadphase = value;
+      else if (name == "cellsize") cellsize = eval<float>(value);
+      else if (name == "size") size = eval<float>(value);
+      else if (name == "frames") frames = eval<int>(value);
+      else if (name == "warmup") warmup = eval<int>(value);
+      else if (name == "seed") seed = eval<unsigned int>(value);
+      else
+        return false;
+    }
+    return (
+      shapes > 0 && frames > 0 && warmup >= 0 && size > 0 && cellsize > 0 &&
+      (layout == "uniform" || layout == "clustered") &&
+      (motion == "moving" || motion == "static") &&
+      (broadphase == "sap" || broadphase == "tree" || broadphase == "grid")
+    );
+  }
+};
+
+// the shapes of the scene with the kinematics of their objects
+struct scene {
+  vector<benchobject*> objects;
+  vector<shape*> shapes;
+  vector<body> bodies;
+  
+  // side of the square the shapes move in
+  float side;
+  
+  ~scene() {
+    for (size_t i = 0; i < shapes.size(); i++)
+      delete shapes[i];
+    for (size_t i = 0; i < objects.size(); i++)
+      delete objects[i];
+  }
+  
+  void build(const options& o) {
+    mt19937 random(o.seed);
+    uniform_real_distribution<float> unit(0, 1);
+    
+    // about one shape per four shape sizes squared, so the pairs per shape
+    // stay the same whatever the scene size
+    side = std::sqrt((float)o.shapes)*o.size*2;
+    
+    // clusters hold 64 shapes on average and spread over a tenth of the side
+    vector<vec2> centers(std::max(1, o.shapes/64));
+    for (size_t c = 0; c < centers.size(); c++)
+      centers[c] = vec2(unit(random)*side, unit(random)*side);
+    normal_distribution<float> spread(0, side*0.1f/std::sqrt((float)centers.size()));
+    
+    for (int i = 0; i < o.shapes; i++) {
+      body b = body();
+      if (o.layout == "clustered") {
+        const vec2& center = centers[random() % centers.size()];
+        b.x = center.x + spread(random);
+        b.y = center.y + spread(random);
+      } else {
+        b.x = unit(random)*side;
+        b.y = unit(random)*side;
+      }
+      if (o.motion == "moving") {
+        b.xspeed = (unit(random)*2 - 1)*100;
+        b.yspeed = (unit(random)*2 - 1)*100;
+      }
+      
+      object::signature sig;
+      benchobject* owner = new benchobject();
+      float extent = o.size*(0.25f + 0.75f*unit(random));
+      shape* sh;
+      if (unit(random) < o.circles) {
+        sig["collider.s.r"] = number(extent*0.5f);
+        sh = new circle(owner, sig, "s");
+      } else {
+        sig["collider.s.w"] = number(extent);
+        sig["collider.s.h"] = number(extent*(0.25f + 0.75f*unit(random)));
+        sh = new rectangle(owner, sig, "s");
+      }
+      sh->bodyid = i;
+      
+      objects.push_back(owner);
+      shapes.push_back(sh);
+      bodies.push_back(b);
+    }
+  }
+  
+  // moves the objects one frame, bouncing them off the scene borders
+  void step(timediff dt) {
+    for (size_t i = 0; i < bodies.size(); i++) {
+      body& b = bodies[i];
+      b.x += b.xspeed*dt;
+      b.y += b.yspeed*dt;
+      if ((b.x < 0 && b.xspeed < 0) || (b.x > side && b.xspeed > 0))
+        b.xspeed = -b.xspeed;
+      if ((b.y < 0 && b.yspeed < 0) || (b.y > side && b.yspeed > 0))
+        b.yspeed = -b.yspeed;
+    }
+  }
+  
+  static string number(float value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%g", value);
+    return buffer;
+  }
+};
+
+static broadphase* createbroadphase(const options& o) {
+  if (o.broadphase == "tree")
+    return new aabbtree();
+  if (o.broadphase == "grid")
+    return new spatialhash(o.cellsize);
+  return new sweepandprune();
+}
+
+static double nanoseconds(benchclock::duration d) {
+  return chrono::duration_cast< chrono::duration<double, nano> >(d).count();
+}
+
+// value below which the given fraction of the sorted samples fall
+static double percentile(const vector<double>& sorted, double fraction) {
+  size_t index = (size_t)std::ceil(fraction*sorted.size());
+  return sorted[std::min(std::max(index, (size_t)1), sorted.size()) - 1];
+}
+
+int main(int argc, char** argv) {
+  options o;
+  if (!o.parse(argc, argv)) {
+    fprintf(stderr, "usage: %s [shapes=N] [circles=F] [layout=uniform|clustered] [motion=moving|static]\n", argv[0]);
+    fprintf(stderr, "       [broadphase=sap|tree|grid] [cellsize=F] [size=F] [frames=N] [warmup=N] [seed=N]\n");
+    return 1;
+  }
+  
+  const timediff dt = 1/60.0f;
+  const int types = shapetypes::size;
+  
+  scene s;
+  s.build(o);
+  broadphase* finder = createbroadphase(o);
+  for (size_t i = 0; i < s.shapes.size(); i++) {
+    s.shapes[i]->box = s.shapes[i]->sweptbounds(s.bodies[i], dt);
+    finder->insert(s.shapes[i], s.shapes[i]->box);
+  }
+  
+  // pairs of the frame grouped by their pair of shape types, lower first
+  vector< vector< pair<shape*, shape*> > > groups(types*types);
+  broadphase::pairlist pairs;
+  
+  vector<double> frametimes;
+  double broadphasetime = 0;
+  vector<double> pairtimes(types*types, 0);
+  vector<long> paircounts(types*types, 0);
+  long hits = 0;
+  
+  for (int frame = 0; frame < o.warmup + o.frames; frame++) {
+    bool measured = (frame >= o.warmup);
+    s.step(dt);
+    
+    benchclock::time_point start = benchclock::now();
+    for (size_t i = 0; i < s.shapes.size(); i++) {
+      shape* sh = s.shapes[i];
+      sh->box = sh->sweptbounds(s.bodies[i], dt);
+      finder->move(sh, sh->box, sh->displacement(s.bodies[i], dt));
+    }
+    pairs.clear();
+    finder->collect(pairs);
+    benchclock::time_point collected = benchclock::now();
+    
+    for (size_t g = 0; g < groups.size(); g++)
+      groups[g].clear();
+    for (size_t p = 0; p < pairs.size(); p++) {
+      shape* a = pairs[p].first;
+      shape* b = pairs[p].second;
+      if (a->type > b->type)
+        std::swap(a, b);
+      groups[a->type*types + b->type].push_back(make_pair(a, b));
+    }
+    
+    // each group is timed as a whole, so the clock costs nothing per pair
+    double frametime = nanoseconds(collected - start);
+    for (size_t g = 0; g < groups.size(); g++) {
+      if (groups[g].empty())
+        continue;
+      
+      benchclock::time_point groupstart = benchclock::now();
+      for (size_t p = 0; p < groups[g].size(); p++) {
+        shape* a = groups[g][p].first;
+        shape* b = groups[g][p].second;
+        timediff toi;
+        if (a->checkcollision(dt, s.bodies[a->bodyid], b, s.bodies[b->bodyid], 1, toi) && measured)
+          hits++;
+      }
+      double elapsed = nanoseconds(benchclock::now() - groupstart);
+      
+      frametime += elapsed;
+      if (measured) {
+        pairtimes[g] += elapsed;
+        paircounts[g] += groups[g].size();
+      }
+    }
+    
+    if (measured) {
+      broadphasetime += nanoseconds(collected - start);
+      frametimes.push_back(frametime);
+    }
+  }
+  delete finder;
+  
+  long totalpairs = 0;
+  double narrowphasetime = 0;
+  for (size_t g = 0; g < pairtimes.size(); g++) {
+    totalpairs += paircounts[g];
+    narrowphasetime += pairtimes[g];
+  }
+  sort(frametimes.begin(), frametimes.end());
+  
+  printf("{\n");
+  printf("  \"shapes\": %d, \"circles\": %g, \"layout\": \"%s\", \"motion\": \"%s\",\n",
+    o.shapes, o.circles, o.layout.c_str(), o.motion.c_str());
+  printf("  \"broadphase\": \"%s\", \"size\": %g, \"frames\": %d, \"seed\": %u,\n",
+    o.broadphase.c_str(), o.size, o.frames, o.seed);
+  printf("  \"pairs\": %ld, \"hits\": %ld,\n", totalpairs, hits);
+  printf("  \"pairs_per_sec\": %.0f,\n", narrowphasetime ? totalpairs/(narrowphasetime*1e-9) : 0.0);
+  printf("  \"broadphase_us_per_frame\": %.3f,\n", broadphasetime/o.frames*1e-3);
+  printf("  \"narrowphase_us_per_frame\": %.3f,\n", narrowphasetime/o.frames*1e-3);
+  printf("  \"ns_per_pair\": {");
+  bool first = true;
+  for (int a = 0; a < types; a++) {
+    for (int b = a; b < types; b++) {
+      int g = a*types + b;
+      if (!paircounts[g])
+        continue;
+      printf("%s\n    \"%s-%s\": { \"pairs\": %ld, \"ns\": %.2f }", first ? "" : ",",
+        shapenames[a], shapenames[b], paircounts[g], pairtimes[g]/paircounts[g]);
+      first = false;
+    }
+  }
+  printf("%s},\n", first ? "" : "\n  ");
+  printf("  \"frame_us\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }\n",
+    percentile(frametimes, 0.5)*1e-3, percentile(frametimes, 0.9)*1e-3,
+    percentile(frametimes, 0.99)*1e-3, frametimes.back()*1e-3);
+  printf("}\n");
+  
+  return 0;
+}
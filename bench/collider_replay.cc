@@ -0,0 +1,330 @@
+// replays a recording made with the collider.record scene parameter through
+// the collider component, without the game. every recorded frame writes
+// the kinematics and geometry of its objects to colliders of their own,
+// creating and deleting them as they come and go, and times the collider
+// update. run it under a profiler to look into a slow frame, or on two
+// builds to compare them.
+//
+// arguments are the recording file, then name=value pairs, all optional:
+//   from=0             first recorded frame replayed
+//   to=-1              last recorded frame replayed, -1 for the last one
+//   repeat=1           times the frames are replayed, from a fresh scene
+//   trace=0            1 prints the time of every frame to stderr
+//   collider.*=value   overrides a scene parameter of the recording
+//
+// polygons keep the outline they had when their object first showed up,
+// and tilemaps the grid. an object whose shapes changed in number or type
+// gets a new collider.
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+
+// the collider headers define their functions, so the component is built
+// into this translation unit instead of being linked to it
+#include "collider.cc"
+
+using namespace std;
+
+typedef chrono::steady_clock replayclock;
+
+struct options {
+  string path;
+  int from;
+  int to;
+  int repeat;
+  bool tracing;
+  object::signature scene;
+  
+  options()
+  : from(0), to(-1), repeat(1), tracing(false)
+  {
+  }
+  
+  // reads the arguments. returns false on unknown names
+  bool parse(int argc, char** argv) {
+    if (argc < 2)
+      return false;
+    path = argv[1];
+    for (int i = 2; i < argc; i++) {
+      string argument = argv[i];
+      size_t equal = argument.find('=');
+      if (equal == string::npos)
+        return false;
+      
+      string name = argument.substr(0, equal);
+      string value = argument.substr(equal + 1);
+      if (name == "from") from = eval<int>(value);
+      else if (name == "to") to = eval<int>(value);
+      else if (name == "repeat") repeat = eval<int>(value);
+      else if (name == "trace") tracing = (value == "1" || value == "true");
+      else if (name.compare(0, 9, "collider.") == 0) scene[name] = value;
+      else
+        return false;
+    }
+    return repeat > 0;
+  }
+};
+
+static string number(float value) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  return buffer;
+}
+
+static string number(uint32_t value) {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u", value);
+  return buffer;
+}
+
+static string shapename(uint32_t s) {
+  return "s" + number(s);
+}
+
+// grid of a recorded tilemap, rebuilt from its blocks, as the rows of its
+// tiles parameter
+static string tiles(const framereader::frame& f, const recording::shaperecord& sh) {
+  if (!sh.points)
+    return "";
+  const recording::point* p = f.points + sh.firstpoint;
+  int columns = std::max((int)p[0].x, 0), rows = std::max((int)p[0].y, 0);
+  vector<string> grid(rows, string(columns, '0'));
+  for (uint32_t i = 1; i + 1 < sh.points; i += 2) {
+    int top = std::max((int)p[i].y, 0), bottom = std::min((int)(p[i].y + p[i + 1].y), rows);
+    int left = std::max((int)p[i].x, 0), right = std::min((int)(p[i].x + p[i + 1].x), columns);
+    for (int r = top; r < bottom; r++) {
+      for (int c = left; c < right; c++)
+        grid[r][c] = '1';
+    }
+  }
+  
+  string lines;
+  for (int r = 0; r < rows; r++)
+    lines += grid[r] + " ";
+  return lines;
+}
+
+// writes the kinematics of a recorded object to its collider
+static void move(component::base* c, const recording::objectrecord& o) {
+  c->write<float>("x", o.x);
+  c->write<float>("y", o.y);
+  c->write<float>("x.speed", o.xspeed);
+  c->write<float>("y.speed", o.yspeed);
+  c->write<float>("x.accel", o.xaccel);
+  c->write<float>("y.accel", o.yaccel);
+}
+
+// writes the geometry of a recorded shape, the s-th of its object
+static void reshape(component::base* c, uint32_t s, const recording::shaperecord& sh) {
+  string prefix = "collider." + shapename(s) + ".";
+  c->write<float>(prefix + "x", sh.x);
+  c->write<float>(prefix + "y", sh.y);
+  if (sh.type == typeindex<circle, shapetypes>::value)
+    c->write<float>(prefix + "r", sh.width);
+  else if (sh.type == typeindex<rectangle, shapetypes>::value || sh.type == typeindex<obb, shapetypes>::value) {
+    c->write<float>(prefix + "w", sh.width);
+    c->write<float>(prefix + "h", sh.height);
+  }
+  if (sh.type == typeindex<obb, shapetypes>::value || sh.type == typeindex<polygon, shapetypes>::value)
+    c->write<float>(prefix + "theta", sh.theta);
+}
+
+// creates the collider of a recorded object, with shapes first to last of
+// the frame
+static component::base* create(
+  const object::signature& scene, const framereader::frame& f,
+  const recording::objectrecord& record, uint32_t first, uint32_t last
+) {
+  object::signature sig = scene;
+  if (record.fixed)
+    sig["collider.static"] = "true";
+  sig["collider.mass"] = number(record.mass);
+  
+  string names;
+  for (uint32_t s = first; s < last; s++) {
+    const recording::shaperecord& sh = f.shapes[s];
+    string prefix = "collider." + shapename(s - first) + ".";
+    names += (names.empty() ? "" : " ") + shapename(s - first);
+    sig[prefix + "type"] = shapenames[sh.type];
+    sig[prefix + "x"] = number(sh.x);
+    sig[prefix + "y"] = number(sh.y);
+    sig[prefix + "w"] = number(sh.width);
+    sig[prefix + "h"] = number(sh.height);
+    sig[prefix + "r"] = number(sh.width);
+    sig[prefix + "theta"] = number(sh.theta);
+    sig[prefix + "layer"] = number(sh.layer);
+    sig[prefix + "mask"] = number(sh.mask);
+    sig[prefix + "tilewidth"] = number(sh.width);
+    sig[prefix + "tileheight"] = number(sh.height);
+    if (sh.fixed)
+      sig[prefix + "static"] = "true";
+    
+    if (sh.type == typeindex<tilemap, shapetypes>::value) {
+      sig[prefix + "tiles"] = tiles(f, sh);
+      continue;
+    }
+    string points;
+    for (uint32_t p = sh.firstpoint; p < sh.firstpoint + sh.points; p++)
+      points += number(f.points[p].x) + " " + number(f.points[p].y) + " ";
+    sig[prefix + "points"] = points;
+  }
+  sig["collider.shapes"] = names;
+  
+  component::base* c = build();
+  move(c, record);
+  c->setup(sig);
+  return c;
+}
+
+// types of the shapes first to last of the frame, to tell when a live
+// object gained or lost shapes
+static vector<uint32_t> layout(const framereader::frame& f, uint32_t first, uint32_t last) {
+  vector<uint32_t> types;
+  for (uint32_t s = first; s < last; s++)
+    types.push_back(f.shapes[s].type);
+  return types;
+}
+
+// value below which the given fraction of the sorted samples fall
+static double percentile(const vector<double>& sorted, double fraction) {
+  size_t index = (size_t)std::ceil(fraction*sorted.size());
+  return sorted[std::min(std::max(index, (size_t)1), sorted.size()) - 1];
+}
+
+int main(int argc, char** argv) {
+  options o;
+  if (!o.parse(argc, argv)) {
+    fprintf(stderr, "usage: %s recording [from=N] [to=N] [repeat=N] [trace=0|1] [collider.name=value ...]\n", argv[0]);
+    return 1;
+  }
+  
+  framereader reader;
+  if (!reader.open(o.path)) {
+    fprintf(stderr, "%s: not a collider recording\n", o.path.c_str());
+    return 1;
+  }
+  
+  // scene parameters of the recording, under those given as arguments
+  object::signature scene;
+  vector<string> lines;
+  split(lines, reader.settings(), '\n');
+  for (size_t i = 0; i < lines.size(); i++) {
+    size_t equal = lines[i].find('=');
+    if (equal != string::npos)
+      scene[lines[i].substr(0, equal)] = lines[i].substr(equal + 1);
+  }
+  for (object::signature::iterator it = o.scene.begin(); it != o.scene.end(); ++it)
+    scene[it->first] = it->second;
+  
+  vector<size_t> selected;
+  for (size_t i = 0; i < reader.size(); i++) {
+    int frame = reader[i].header->frame;
+    if (frame >= o.from && (o.to < 0 || frame <= o.to))
+      selected.push_back(i);
+  }
+  if (selected.empty()) {
+    fprintf(stderr, "%s: no frames to replay\n", o.path.c_str());
+    return 1;
+  }
+  
+  // time of each replayed frame over all runs, and the slowest of them
+  vector<double> frametimes;
+  double slowest = 0;
+  int slowestframe = -1;
+  long shapes = 0;
+  int timestamp = 0;
+  
+  for (int run = 0; run < o.repeat; run++) {
+    map<uint32_t, component::base*> live;
+    map<uint32_t, vector<uint32_t> > layouts;
+    map<uint32_t, int> seen;
+    
+    for (size_t n = 0; n < selected.size(); n++) {
+      const framereader::frame& f = reader[selected[n]];
+      
+      // shapes of an object follow each other in the frame
+      uint32_t s = 0;
+      for (uint32_t i = 0; i < f.header->objects; i++) {
+        const recording::objectrecord& record = f.objects[i];
+        uint32_t first = s;
+        while (s < f.header->shapes && f.shapes[s].object == i)
+          s++;
+        
+        seen[record.id] = timestamp;
+        vector<uint32_t> types = layout(f, first, s);
+        map<uint32_t, component::base*>::iterator it = live.find(record.id);
+        if (it != live.end() && layouts[record.id] != types) {
+          delete it->second;
+          live.erase(it);
+          it = live.end();
+        }
+        if (it == live.end()) {
+          live[record.id] = create(scene, f, record, first, s);
+          layouts[record.id] = types;
+          continue;
+        }
+        move(it->second, record);
+        for (uint32_t k = first; k < s; k++)
+          reshape(it->second, k - first, f.shapes[k]);
+      }
+      
+      // objects gone from the frame were deleted in the game
+      for (map<uint32_t, component::base*>::iterator it = live.begin(); it != live.end();) {
+        if (seen[it->first] == timestamp) {
+          ++it;
+          continue;
+        }
+        delete it->second;
+        seen.erase(it->first);
+        layouts.erase(it->first);
+        live.erase(it++);
+      }
+      
+      if (live.empty()) {
+        timestamp++;
+        continue;
+      }
+      replayclock::time_point start = replayclock::now();
+      live.begin()->second->update(f.header->dt, timestamp++);
+      double elapsed = chrono::duration_cast< chrono::duration<double, micro> >(replayclock::now() - start).count();
+      
+      frametimes.push_back(elapsed);
+      shapes += f.header->shapes;
+      if (elapsed > slowest) {
+        slowest = elapsed;
+        slowestframe = f.header->frame;
+      }
+      if (o.tracing)
+        fprintf(stderr, "%d %.3f\n", f.header->frame, elapsed);
+    }
+    
+    for (map<uint32_t, component::base*>::iterator it = live.begin(); it != live.end(); ++it)
+      delete it->second;
+  }
+  
+  if (frametimes.empty()) {
+    fprintf(stderr, "%s: no frames with objects\n", o.path.c_str());
+    return 1;
+  }
+  double total = 0;
+  for (size_t i = 0; i < frametimes.size(); i++)
+    total += frametimes[i];
+  sort(frametimes.begin(), frametimes.end());
+  
+  printf("{\n");
+  printf("  \"recording\": \"%s\", \"frames\": %d, \"repeat\": %d,\n", o.path.c_str(), (int)selected.size(), o.repeat);
+  printf("  \"shapes_per_frame\": %.1f,\n", (double)shapes/frametimes.size());
+  printf("  \"total_ms\": %.3f,\n", total*1e-3);
+  printf("  \"frame_us\": { \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+    total/frametimes.size(), percentile(frametimes, 0.5), percentile(frametimes, 0.9),
+    percentile(frametimes, 0.99), frametimes.back());
+  printf("  \"slowest_frame\": %d\n", slowestframe);
+  printf("}\n");
+  
+  return 0;
+}
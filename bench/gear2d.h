@@ -0,0 +1,194 @@
+#ifndef GEAR2D_H
+#define GEAR2D_H
+
+// minimal stand-in for the parts of the gear2d api the collision code uses,
+// so the benchmark builds without a gear2d install. parameters live in a map
+// of their component and hooks only reach the component that set them. it
+// is not meant to run components inside a game.
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <sstream>
+#include <exception>
+
+namespace gear2d {
+  typedef float timediff;
+  
+  class evil : public std::exception {
+    private:
+      std::string message;
+      
+    public:
+      evil(const std::string& message) throw()
+      : message(message)
+      {
+      }
+      virtual ~evil() throw() { }
+      
+      virtual const char* what() const throw() {
+        return message.c_str();
+      }
+  };
+  
+  // value of the string, or fallback if it doesn't parse as a T
+  template<typename T>
+  T eval(const std::string& value, const T& fallback = T()) {
+    std::istringstream stream(value);
+    T result;
+    if (!(stream >> result))
+      return fallback;
+    return result;
+  }
+  
+  template<>
+  inline std::string eval<std::string>(const std::string& value, const std::string&) {
+    return value;
+  }
+  
+  // appends to out the non empty pieces of in between separators
+  template<typename C>
+  void split(C& out, const std::string& in, char separator) {
+    std::istringstream stream(in);
+    std::string piece;
+    while (std::getline(stream, piece, separator)) {
+      if (piece.size())
+        out.insert(out.end(), piece);
+    }
+  }
+  
+  namespace object {
+    typedef std::map<std::string, std::string> signature;
+    typedef void* id;
+  }
+  
+  class parameterbase {
+    public:
+      typedef std::string id;
+      
+      virtual ~parameterbase() { }
+  };
+  
+  template<typename T>
+  class parameter : public parameterbase {
+    public:
+      T value;
+      
+      parameter()
+      : value()
+      {
+      }
+  };
+  
+  namespace component {
+    class base;
+  }
+  
+  // handle to a parameter. writes through it notify the hooks
+  template<typename T>
+  class link {
+    private:
+      parameter<T>* target;
+      component::base* owner;
+      std::string pid;
+      
+    public:
+      link()
+      : target(0), owner(0)
+      {
+      }
+      link(parameter<T>* target, component::base* owner, const std::string& pid)
+      : target(target), owner(owner), pid(pid)
+      {
+      }
+      
+      operator const T&() const {
+        return target->value;
+      }
+      
+      const T& get() const {
+        return target->value;
+      }
+      
+      link& operator=(const T& value);
+  };
+  
+  namespace component {
+    typedef std::string family;
+    typedef std::string type;
+    
+    class base {
+      private:
+        std::map<std::string, parameterbase*> parameters;
+        std::set<std::string> hooked;
+        
+      public:
+        virtual ~base() {
+          std::map<std::string, parameterbase*>::iterator it;
+          for (it = parameters.begin(); it != parameters.end(); ++it)
+            delete it->second;
+        }
+        
+        virtual component::family family() = 0;
+        virtual component::type type() = 0;
+        virtual std::string depends() { return ""; }
+        virtual void setup(object::signature& sig) = 0;
+        virtual void update(timediff dt, int begin) = 0;
+        virtual void handle(parameterbase::id, base*, object::id) { }
+        
+        template<typename T>
+        void write(const std::string& pid, const T& value) {
+          get<T>(pid)->value = value;
+          notify(pid);
+        }
+        
+        template<typename T>
+        void read(const std::string& pid, T& value) {
+          value = get<T>(pid)->value;
+        }
+        
+        template<typename T>
+        const T& read(const std::string& pid) {
+          return get<T>(pid)->value;
+        }
+        
+        template<typename T>
+        link<T> fetch(const std::string& pid) {
+          return link<T>(get<T>(pid), this, pid);
+        }
+        
+        void hook(const std::string& pid) {
+          hooked.insert(pid);
+        }
+        
+        void notify(const std::string& pid) {
+          if (hooked.count(pid))
+            handle(pid, this, 0);
+        }
+        
+      private:
+        template<typename T>
+        parameter<T>* get(const std::string& pid) {
+          parameterbase*& p = parameters[pid];
+          if (!p)
+            p = new parameter<T>();
+          return static_cast<parameter<T>*>(p);
+        }
+    };
+  }
+  
+  template<typename T>
+  link<T>& link<T>::operator=(const T& value) {
+    target->value = value;
+    owner->notify(pid);
+    return *this;
+  }
+}
+
+#define moderr(name)
+#define modinfo(name)
+#define trace(...) do { } while (0)
+#define g2dcomponent(name) extern "C" gear2d::component::base* build() { return new name(); }
+
+#endif
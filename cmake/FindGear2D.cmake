@@ -95,11 +95,11 @@ endif(WIN32)
 IF(Gear2D_INCLUDE_DIR)
   IF(Gear2D_LIBRARY)
     SET(Gear2D_FOUND TRUE)
-  ELSE(Gear2D_LIBRARY)
-    message(ERROR "Missing Gear2D_LIBRARY")
+  ELSEIF(NOT Gear2D_FIND_QUIETLY)
+    message(STATUS "Missing Gear2D_LIBRARY")
   ENDIF(Gear2D_LIBRARY)
-ELSE(Gear2D_INCLUDE_DIR)
-  message(FATAL_ERROR "Missing Gear2D_INCLUDE_DIR")
+ELSEIF(NOT Gear2D_FIND_QUIETLY)
+  message(STATUS "Missing Gear2D_INCLUDE_DIR")
 ENDIF(Gear2D_INCLUDE_DIR)
 
 IF(Gear2D_FOUND)
@@ -0,0 +1,422 @@
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include <vector>
+#include <algorithm>
+#include "broadphase.h"
+
+// dynamic bounding volume tree broadphase, in the lines of box2d's
+// b2DynamicTree. every shape is a leaf holding a fattened box: the real box
+// grown by a margin and by the motion predicted for the shape. the leaf is
+// only reinserted when the real box leaves the fat one, so slow shapes and
+// static ones cost nothing to update. inner nodes are kept balanced by
+// rotations, and insertions pick the sibling with the smallest perimeter
+// growth, which copes well with huge static shapes next to small fast ones.
+class aabbtree : public broadphase {
+  private:
+    struct node {
+      // fattened box for leaves, box of both children for inner nodes
+      aabb box;
+      
+      // real box of the shape, leaves only
+      aabb tight;
+      
+      shape* sh;
+      
+      // next free node while the node is in the free list
+      int parent;
+      int child1, child2;
+      
+      // leaves have height 0 and free nodes -1
+      int height;
+      
+      bool leaf() const {
+        return child1 == -1;
+      }
+    };
+    
+    std::vector<node> nodes;
+    int root;
+    int freelist;
+    
+    // traversal stack, kept to avoid allocations on every query
+    std::vector<int> stack;
+    
+    // node and rays of a batch of ray casts still to visit
+    struct packet {
+      int node;
+      int begin, end;
+      
+      packet(int node, int begin, int end)
+      : node(node), begin(begin), end(end)
+      {
+      }
+    };
+    
+    // ray cast traversal state, also kept between queries
+    std::vector<packet> packets;
+    std::vector<int> active;
+    
+    // how much a leaf box is grown beyond the shape box and how many frames
+    // of predicted motion it covers
+    float margin;
+    float multiplier;
+    
+  public:
+    aabbtree(float margin = 4, float multiplier = 2)
+    : root(-1), freelist(-1), margin(margin), multiplier(multiplier)
+    {
+    }
+    
+    virtual void insert(shape* sh, const aabb& box) {
+      int leaf = allocate();
+      nodes[leaf].tight = box;
+      nodes[leaf].box = fatten(box, vec2(0, 0));
+      nodes[leaf].sh = sh;
+      nodes[leaf].height = 0;
+      insertleaf(leaf);
+      sh->proxy = leaf;
+    }
+    
+    virtual void remove(shape* sh) {
+      removeleaf(sh->proxy);
+      release(sh->proxy);
+      sh->proxy = -1;
+    }
+    
+    virtual void move(shape* sh, const aabb& box, const vec2& displacement) {
+      int leaf = sh->proxy;
+      nodes[leaf].tight = box;
+      
+      // the fat box still holds the shape. it is only rebuilt if it became
+      // much larger than the box the shape would get now, which happens
+      // when a fast shape slows down
+      aabb fat = fatten(box, displacement);
+      if (nodes[leaf].box.contains(box)) {
+        aabb huge = fat;
+        huge.xmin -= 4*margin;
+        huge.ymin -= 4*margin;
+        huge.xmax += 4*margin;
+        huge.ymax += 4*margin;
+        if (huge.contains(nodes[leaf].box))
+          return;
+      }
+      
+      removeleaf(leaf);
+      nodes[leaf].box = fat;
+      insertleaf(leaf);
+    }
+    
+    virtual void collect(pairlist& pairs) {
+      for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].height != 0)
+          continue;
+        
+        stack.clear();
+        if (root != -1)
+          stack.push_back(root);
+        
+        while (stack.size()) {
+          int n = stack.back();
+          stack.pop_back();
+          if (!nodes[n].box.overlaps(nodes[i].box))
+            continue;
+          
+          if (!nodes[n].leaf()) {
+            stack.push_back(nodes[n].child1);
+            stack.push_back(nodes[n].child2);
+            continue;
+          }
+          
+          // fat boxes overlap both ways, so each pair is found twice and
+          // kept only from its lower leaf
+          if ((int)i >= n || !nodes[i].sh->interacts(nodes[n].sh))
+            continue;
+          if (nodes[i].tight.overlaps(nodes[n].tight))
+            pairs.push_back(std::make_pair(nodes[i].sh, nodes[n].sh));
+        }
+      }
+    }
+    
+    // appends to found the shapes whose real boxes overlap box
+    virtual void query(const aabb& box, std::vector<shape*>& found) {
+      stack.clear();
+      if (root != -1)
+        stack.push_back(root);
+      
+      while (stack.size()) {
+        int n = stack.back();
+        stack.pop_back();
+        if (!nodes[n].box.overlaps(box))
+          continue;
+        
+        if (nodes[n].leaf()) {
+          if (nodes[n].tight.overlaps(box))
+            found.push_back(nodes[n].sh);
+        } else {
+          stack.push_back(nodes[n].child1);
+          stack.push_back(nodes[n].child2);
+        }
+      }
+    }
+    
+    // walks the tree once for the whole batch. every node keeps the rays
+    // that cross its box and only passes those down to its children
+    virtual void raycast(const ray* rays, int count, std::vector< std::pair<int, shape*> >& found) {
+      if (root == -1 || !count)
+        return;
+      
+      // the rays of a packet are active[begin] up to active[end]
+      active.clear();
+      for (int i = 0; i < count; i++)
+        active.push_back(i);
+      packets.clear();
+      packets.push_back(packet(root, 0, count));
+      
+      float t;
+      vec2 normal;
+      while (packets.size()) {
+        packet p = packets.back();
+        packets.pop_back();
+        const node& n = nodes[p.node];
+        
+        int begin = active.size();
+        for (int k = p.begin; k < p.end; k++) {
+          int i = active[k];
+          if (n.box.raycast(rays[i].from, rays[i].to, t, normal))
+            active.push_back(i);
+        }
+        int end = active.size();
+        if (begin == end)
+          continue;
+        
+        if (n.leaf()) {
+          for (int k = begin; k < end; k++) {
+            int i = active[k];
+            if (n.tight.raycast(rays[i].from, rays[i].to, t, normal))
+              found.push_back(std::make_pair(i, n.sh));
+          }
+        } else {
+          packets.push_back(packet(n.child1, begin, end));
+          packets.push_back(packet(n.child2, begin, end));
+        }
+      }
+    }
+    
+  private:
+    aabb fatten(const aabb& box, const vec2& displacement) const {
+      aabb fat(box.xmin - margin, box.ymin - margin, box.xmax + margin, box.ymax + margin);
+      float dx = multiplier*displacement.x;
+      float dy = multiplier*displacement.y;
+      if (dx < 0) fat.xmin += dx; else fat.xmax += dx;
+      if (dy < 0) fat.ymin += dy; else fat.ymax += dy;
+      return fat;
+    }
+    
+    int allocate() {
+      int n;
+      if (freelist != -1) {
+        n = freelist;
+        freelist = nodes[n].parent;
+      } else {
+        n = nodes.size();
+        nodes.push_back(node());
+      }
+      nodes[n].sh = 0;
+      nodes[n].parent = -1;
+      nodes[n].child1 = -1;
+      nodes[n].child2 = -1;
+      nodes[n].height = 0;
+      return n;
+    }
+    
+    void release(int n) {
+      nodes[n].sh = 0;
+      nodes[n].parent = freelist;
+      nodes[n].height = -1;
+      freelist = n;
+    }
+    
+    void insertleaf(int leaf) {
+      if (root == -1) {
+        root = leaf;
+        nodes[root].parent = -1;
+        return;
+      }
+      
+      // descends to the best sibling, by the perimeter growth the new leaf
+      // causes to each subtree
+      aabb leafbox = nodes[leaf].box;
+      int index = root;
+      while (!nodes[index].leaf()) {
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+        
+        float perimeter = nodes[index].box.perimeter();
+        float combined = aabb::combine(nodes[index].box, leafbox).perimeter();
+        
+        // cost of creating a new parent for this node and the new leaf
+        float cost = 2*combined;
+        
+        // minimum cost of pushing the leaf further down the tree
+        float inheritance = 2*(combined - perimeter);
+        
+        float cost1 = descentcost(child1, leafbox) + inheritance;
+        float cost2 = descentcost(child2, leafbox) + inheritance;
+        
+        if (cost < cost1 && cost < cost2)
+          break;
+        
+        index = (cost1 < cost2) ? child1 : child2;
+      }
+      
+      // creates a new parent for the sibling and the leaf
+      int sibling = index;
+      int oldparent = nodes[sibling].parent;
+      int newparent = allocate();
+      nodes[newparent].parent = oldparent;
+      nodes[newparent].box = aabb::combine(leafbox, nodes[sibling].box);
+      nodes[newparent].height = nodes[sibling].height + 1;
+      nodes[newparent].child1 = sibling;
+      nodes[newparent].child2 = leaf;
+      nodes[sibling].parent = newparent;
+      nodes[leaf].parent = newparent;
+      
+      if (oldparent != -1) {
+        if (nodes[oldparent].child1 == sibling)
+          nodes[oldparent].child1 = newparent;
+        else
+          nodes[oldparent].child2 = newparent;
+      } else
+        root = newparent;
+      
+      refit(nodes[leaf].parent);
+    }
+    
+    void removeleaf(int leaf) {
+      if (leaf == root) {
+        root = -1;
+        return;
+      }
+      
+      int parent = nodes[leaf].parent;
+      int grandparent = nodes[parent].parent;
+      int sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+      
+      // the sibling takes the place of the parent, which is destroyed
+      if (grandparent != -1) {
+        if (nodes[grandparent].child1 == parent)
+          nodes[grandparent].child1 = sibling;
+        else
+          nodes[grandparent].child2 = sibling;
+        nodes[sibling].parent = grandparent;
+        release(parent);
+        refit(grandparent);
+      } else {
+        root = sibling;
+        nodes[sibling].parent = -1;
+        release(parent);
+      }
+    }
+    
+    float descentcost(int child, const aabb& leafbox) const {
+      float combined = aabb::combine(leafbox, nodes[child].box).perimeter();
+      if (nodes[child].leaf())
+        return combined;
+      return combined - nodes[child].box.perimeter();
+    }
+    
+    // walks up from index rebalancing and fixing boxes and heights
+    void refit(int index) {
+      while (index != -1) {
+        index = balance(index);
+        
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+        nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[index].box = aabb::combine(nodes[child1].box, nodes[child2].box);
+        
+        index = nodes[index].parent;
+      }
+    }
+    
+    // performs a left or right rotation if node a is imbalanced and returns
+    // the new root of the subtree
+    int balance(int a) {
+      if (nodes[a].leaf() || nodes[a].height < 2)
+        return a;
+      
+      int b = nodes[a].child1;
+      int c = nodes[a].child2;
+      int difference = nodes[c].height - nodes[b].height;
+      
+      // rotates c up
+      if (difference > 1) {
+        int f = nodes[c].child1;
+        int g = nodes[c].child2;
+        
+        nodes[c].child1 = a;
+        nodes[c].parent = nodes[a].parent;
+        nodes[a].parent = c;
+        replacechild(nodes[c].parent, a, c);
+        
+        if (nodes[f].height > nodes[g].height) {
+          nodes[c].child2 = f;
+          nodes[a].child2 = g;
+          nodes[g].parent = a;
+        } else {
+          nodes[c].child2 = g;
+          nodes[a].child2 = f;
+          nodes[f].parent = a;
+        }
+        fix(a);
+        fix(c);
+        return c;
+      }
+      
+      // rotates b up
+      if (difference < -1) {
+        int d = nodes[b].child1;
+        int e = nodes[b].child2;
+        
+        nodes[b].child1 = a;
+        nodes[b].parent = nodes[a].parent;
+        nodes[a].parent = b;
+        replacechild(nodes[b].parent, a, b);
+        
+        if (nodes[d].height > nodes[e].height) {
+          nodes[b].child2 = d;
+          nodes[a].child1 = e;
+          nodes[e].parent = a;
+        } else {
+          nodes[b].child2 = e;
+          nodes[a].child1 = d;
+          nodes[d].parent = a;
+        }
+        fix(a);
+        fix(b);
+        return b;
+      }
+      
+      return a;
+    }
+    
+    void replacechild(int parent, int oldchild, int newchild) {
+      if (parent == -1)
+        root = newchild;
+      else if (nodes[parent].child1 == oldchild)
+        nodes[parent].child1 = newchild;
+      else
+        nodes[parent].child2 = newchild;
+    }
+    
+    // recomputes box and height of an inner node from its children
+    void fix(int n) {
+      int child1 = nodes[n].child1;
+      int child2 = nodes[n].child2;
+      nodes[n].box = aabb::combine(nodes[child1].box, nodes[child2].box);
+      nodes[n].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+    }
+};
+
+#endif
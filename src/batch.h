@@ -0,0 +1,279 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <algorithm>
+#include "shapes.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_AVX
+#include <immintrin.h>
+#endif
+
+// batched narrowphase kernels for the pairs of the most common shape types.
+// pairs are stored in structure of arrays layout, as the motion of the first
+// shape relative to the second, so one kernel call tests 8 pairs at once with
+// avx, 4 with sse2 or one at a time with the portable fallback. the kernel
+// is picked at runtime from what the cpu supports.
+//
+// results are written to a hit bitmask: bit i%32 of word i/32 is set when
+// pair i collides.
+
+// relative motion of the pairs: d + dv*t + da*t*t/2
+struct pairmotion {
+  std::vector<float> dx, dy;
+  std::vector<float> dvx, dvy;
+  std::vector<float> dax, day;
+  
+  void clear() {
+    dx.clear(); dy.clear();
+    dvx.clear(); dvy.clear();
+    dax.clear(); day.clear();
+  }
+  
+  void add(const shape& a, const body& abody, const shape& b, const body& bbody) {
+    vec2 d = a.getpos(abody, 0) - b.getpos(bbody, 0);
+    dx.push_back(d.x);
+    dy.push_back(d.y);
+    dvx.push_back(abody.xspeed - bbody.xspeed);
+    dvy.push_back(abody.yspeed - bbody.yspeed);
+    dax.push_back(abody.xaccel - bbody.xaccel);
+    day.push_back(abody.yaccel - bbody.yaccel);
+  }
+  
+  int size() const {
+    return dx.size();
+  }
+};
+
+struct circlepairs : public pairmotion {
+  // sum of the radii of each pair
+  std::vector<float> radii;
+  
+  void clear() {
+    pairmotion::clear();
+    radii.clear();
+  }
+  
+  void add(const circle& a, const body& abody, const circle& b, const body& bbody) {
+    pairmotion::add(a, abody, b, bbody);
+    radii.push_back(a.radius() + b.radius());
+  }
+};
+
+struct rectanglepairs : public pairmotion {
+  std::vector<float> aw, ah, bw, bh;
+  
+  void clear() {
+    pairmotion::clear();
+    aw.clear(); ah.clear();
+    bw.clear(); bh.clear();
+  }
+  
+  void add(const rectangle& a, const body& abody, const rectangle& b, const body& bbody) {
+    pairmotion::add(a, abody, b, bbody);
+    aw.push_back(a.width());
+    ah.push_back(a.height());
+    bw.push_back(b.width());
+    bh.push_back(b.height());
+  }
+};
+
+namespace batch {
+  // kernels test pairs [begin, end) at time t and or the results into hits.
+  // begin is always a multiple of the kernel width.
+  typedef void (*circlekernel)(const circlepairs&, int begin, int end, float t, unsigned int* hits);
+  typedef void (*rectanglekernel)(const rectanglepairs&, int begin, int end, float t, unsigned int* hits);
+  
+  // ===========================================================================
+  // portable kernels
+  // ===========================================================================
+  
+  inline void circlesscalar(const circlepairs& p, int begin, int end, float t, unsigned int* hits) {
+    float half = 0.5f*t*t;
+    for (int i = begin; i < end; i++) {
+      // squared distances are compared, so no square root is taken
+      float x = p.dx[i] + p.dvx[i]*t + p.dax[i]*half;
+      float y = p.dy[i] + p.dvy[i]*t + p.day[i]*half;
+      if (x*x + y*y <= p.radii[i]*p.radii[i])
+        hits[i >> 5] |= 1u << (i & 31);
+    }
+  }
+  
+  inline void rectanglesscalar(const rectanglepairs& p, int begin, int end, float t, unsigned int* hits) {
+    float half = 0.5f*t*t;
+    for (int i = begin; i < end; i++) {
+      float x = p.dx[i] + p.dvx[i]*t + p.dax[i]*half;
+      float y = p.dy[i] + p.dvy[i]*t + p.day[i]*half;
+      if (x <= p.bw[i] && -x <= p.aw[i] && y <= p.bh[i] && -y <= p.ah[i])
+        hits[i >> 5] |= 1u << (i & 31);
+    }
+  }
+  
+  // ===========================================================================
+  // sse2 kernels, 4 pairs at once
+  // ===========================================================================
+
+#ifdef BATCH_SSE2
+  inline void circlessse2(const circlepairs& p, int begin, int end, float t, unsigned int* hits) {
+    __m128 vt = _mm_set1_ps(t);
+    __m128 vhalf = _mm_set1_ps(0.5f*t*t);
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+      __m128 x = _mm_add_ps(_mm_loadu_ps(&p.dx[i]), _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(&p.dvx[i]), vt), _mm_mul_ps(_mm_loadu_ps(&p.dax[i]), vhalf)));
+      __m128 y = _mm_add_ps(_mm_loadu_ps(&p.dy[i]), _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(&p.dvy[i]), vt), _mm_mul_ps(_mm_loadu_ps(&p.day[i]), vhalf)));
+      __m128 r = _mm_loadu_ps(&p.radii[i]);
+      __m128 hit = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(r, r));
+      hits[i >> 5] |= (unsigned int)_mm_movemask_ps(hit) << (i & 31);
+    }
+    circlesscalar(p, i, end, t, hits);
+  }
+  
+  inline void rectanglessse2(const rectanglepairs& p, int begin, int end, float t, unsigned int* hits) {
+    __m128 vt = _mm_set1_ps(t);
+    __m128 vhalf = _mm_set1_ps(0.5f*t*t);
+    __m128 zero = _mm_setzero_ps();
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+      __m128 x = _mm_add_ps(_mm_loadu_ps(&p.dx[i]), _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(&p.dvx[i]), vt), _mm_mul_ps(_mm_loadu_ps(&p.dax[i]), vhalf)));
+      __m128 y = _mm_add_ps(_mm_loadu_ps(&p.dy[i]), _mm_add_ps(
+        _mm_mul_ps(_mm_loadu_ps(&p.dvy[i]), vt), _mm_mul_ps(_mm_loadu_ps(&p.day[i]), vhalf)));
+      __m128 hit = _mm_and_ps(
+        _mm_and_ps(_mm_cmple_ps(x, _mm_loadu_ps(&p.bw[i])), _mm_cmple_ps(_mm_sub_ps(zero, x), _mm_loadu_ps(&p.aw[i]))),
+        _mm_and_ps(_mm_cmple_ps(y, _mm_loadu_ps(&p.bh[i])), _mm_cmple_ps(_mm_sub_ps(zero, y), _mm_loadu_ps(&p.ah[i]))));
+      hits[i >> 5] |= (unsigned int)_mm_movemask_ps(hit) << (i & 31);
+    }
+    rectanglesscalar(p, i, end, t, hits);
+  }
+#endif
+  
+  // ===========================================================================
+  // avx kernels, 8 pairs at once. compiled for avx regardless of the build
+  // flags and only called when the cpu supports it
+  // ===========================================================================
+
+#ifdef BATCH_AVX
+  __attribute__((target("avx")))
+  inline void circlesavx(const circlepairs& p, int begin, int end, float t, unsigned int* hits) {
+    __m256 vt = _mm256_set1_ps(t);
+    __m256 vhalf = _mm256_set1_ps(0.5f*t*t);
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+      __m256 x = _mm256_add_ps(_mm256_loadu_ps(&p.dx[i]), _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(&p.dvx[i]), vt), _mm256_mul_ps(_mm256_loadu_ps(&p.dax[i]), vhalf)));
+      __m256 y = _mm256_add_ps(_mm256_loadu_ps(&p.dy[i]), _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(&p.dvy[i]), vt), _mm256_mul_ps(_mm256_loadu_ps(&p.day[i]), vhalf)));
+      __m256 r = _mm256_loadu_ps(&p.radii[i]);
+      __m256 hit = _mm256_cmp_ps(
+        _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(r, r), _CMP_LE_OQ);
+      hits[i >> 5] |= (unsigned int)_mm256_movemask_ps(hit) << (i & 31);
+    }
+    circlesscalar(p, i, end, t, hits);
+  }
+  
+  __attribute__((target("avx")))
+  inline void rectanglesavx(const rectanglepairs& p, int begin, int end, float t, unsigned int* hits) {
+    __m256 vt = _mm256_set1_ps(t);
+    __m256 vhalf = _mm256_set1_ps(0.5f*t*t);
+    __m256 zero = _mm256_setzero_ps();
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+      __m256 x = _mm256_add_ps(_mm256_loadu_ps(&p.dx[i]), _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(&p.dvx[i]), vt), _mm256_mul_ps(_mm256_loadu_ps(&p.dax[i]), vhalf)));
+      __m256 y = _mm256_add_ps(_mm256_loadu_ps(&p.dy[i]), _mm256_add_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(&p.dvy[i]), vt), _mm256_mul_ps(_mm256_loadu_ps(&p.day[i]), vhalf)));
+      __m256 hit = _mm256_and_ps(
+        _mm256_and_ps(
+          _mm256_cmp_ps(x, _mm256_loadu_ps(&p.bw[i]), _CMP_LE_OQ),
+          _mm256_cmp_ps(_mm256_sub_ps(zero, x), _mm256_loadu_ps(&p.aw[i]), _CMP_LE_OQ)),
+        _mm256_and_ps(
+          _mm256_cmp_ps(y, _mm256_loadu_ps(&p.bh[i]), _CMP_LE_OQ),
+          _mm256_cmp_ps(_mm256_sub_ps(zero, y), _mm256_loadu_ps(&p.ah[i]), _CMP_LE_OQ)));
+      hits[i >> 5] |= (unsigned int)_mm256_movemask_ps(hit) << (i & 31);
+    }
+    rectanglesscalar(p, i, end, t, hits);
+  }
+#endif
+  
+  // ===========================================================================
+  // kernel selection
+  // ===========================================================================
+  
+  inline bool hasavx() {
+#ifdef BATCH_AVX
+    static bool avx = __builtin_cpu_supports("avx");
+    return avx;
+#else
+    return false;
+#endif
+  }
+  
+  inline circlekernel circles() {
+#ifdef BATCH_AVX
+    if (hasavx())
+      return &circlesavx;
+#endif
+#ifdef BATCH_SSE2
+    return &circlessse2;
+#else
+    return &circlesscalar;
+#endif
+  }
+  
+  inline rectanglekernel rectangles() {
+#ifdef BATCH_AVX
+    if (hasavx())
+      return &rectanglesavx;
+#endif
+#ifdef BATCH_SSE2
+    return &rectanglessse2;
+#else
+    return &rectanglesscalar;
+#endif
+  }
+  
+  // runs the kernel over all pairs at the given interpolation steps, the
+  // same the scalar narrowphase would take. hits is resized to hold one bit
+  // per pair and times receives, for each colliding pair, the first step
+  // where it collides
+  template<typename pairs, typename kernel>
+  inline void test(const pairs& p, kernel run, timediff dt, int steps, std::vector<unsigned int>& hits, std::vector<timediff>& times) {
+    int words = (p.size() + 31)/32;
+    hits.assign(words, 0);
+    times.resize(p.size());
+    for (int step = 0; step <= steps; step++) {
+      timediff t = dt*step/steps;
+      
+      // the bits set by this step are the pairs hit for the first time
+      for (int w = 0; w < words; w++) {
+        unsigned int before = hits[w];
+        run(p, w*32, std::min(w*32 + 32, p.size()), t, &hits[w] - w);
+        unsigned int fresh = hits[w] & ~before;
+        for (int bit = 0; fresh; bit++, fresh >>= 1) {
+          if (fresh & 1)
+            times[w*32 + bit] = t;
+        }
+      }
+    }
+  }
+  
+  inline void test(const circlepairs& p, timediff dt, int steps, std::vector<unsigned int>& hits, std::vector<timediff>& times) {
+    static circlekernel kernel = circles();
+    test(p, kernel, dt, steps, hits, times);
+  }
+  
+  inline void test(const rectanglepairs& p, timediff dt, int steps, std::vector<unsigned int>& hits, std::vector<timediff>& times) {
+    static rectanglekernel kernel = rectangles();
+    test(p, kernel, dt, steps, hits, times);
+  }
+}
+
+#endif
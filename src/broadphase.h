@@ -0,0 +1,58 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "shapes.h"
+#include "query.h"
+
+// base class of the structures used to cull shape pairs before the
+// narrowphase. shapes are registered together with their bounding box, the
+// box is refreshed every frame through move() and collect() reports only the
+// pairs whose boxes overlap.
+class broadphase {
+  public:
+    typedef std::vector< std::pair<shape*, shape*> > pairlist;
+    
+  public:
+    virtual ~broadphase() { }
+    
+    virtual void insert(shape* sh, const aabb& box) = 0;
+    virtual void remove(shape* sh) = 0;
+    // refreshes the box of a shape. displacement is the motion predicted for
+    // the shape, which some structures use to avoid updates on every frame
+    virtual void move(shape* sh, const aabb& box, const vec2& displacement) = 0;
+    
+    // appends to pairs every pair of shapes whose boxes overlap. pairs that
+    // don't pass shape::interacts, such as shapes owned by the same
+    // component or filtered out by their layers, are never reported.
+    virtual void collect(pairlist& pairs) = 0;
+    
+    // appends to found every shape whose box overlaps box, once each
+    virtual void query(const aabb& box, std::vector<shape*>& found) = 0;
+    
+    // appends to found, as ray index and shape, the shapes whose boxes are
+    // crossed by each ray. by default every ray queries its own box
+    virtual void raycast(const ray* rays, int count, std::vector< std::pair<int, shape*> >& found) {
+      for (int i = 0; i < count; i++) {
+        const vec2& from = rays[i].from;
+        const vec2& to = rays[i].to;
+        aabb box(std::min(from.x, to.x), std::min(from.y, to.y), std::max(from.x, to.x), std::max(from.y, to.y));
+        
+        crossed.clear();
+        query(box, crossed);
+        for (size_t k = 0; k < crossed.size(); k++) {
+          float t;
+          vec2 normal;
+          if (crossed[k]->box.raycast(from, to, t, normal))
+            found.push_back(std::make_pair(i, crossed[k]));
+        }
+      }
+    }
+    
+  private:
+    std::vector<shape*> crossed;
+};
+
+#endif
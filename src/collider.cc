@@ -2,62 +2,397 @@
 #include "gear2d.h"
 
 #include "shapes.h"
+#include "sweepandprune.h"
+#include "spatialhash.h"
+#include "aabbtree.h"
+#include "batch.h"
+#include "workerpool.h"
+#include "pairtable.h"
+#include "stats.h"
+#include "solver.h"
+#include "recording.h"
 
 using namespace gear2d;
 using namespace std;
 
 class collider : public component::base {
   private:
-    // container to hold a pair of collision check
-    struct interaction {
+    // container to hold a pair of collision check. interactions persist
+    // while the broadphase keeps reporting the pair and cache the last
+    // narrowphase result along with everything it was computed from.
+    // interactions live in a pool and are listed by both of their shapes
+    struct interaction : public pairrecord {
       public:
-        static bool interactions_changed;
-        
         int update_timestamp;
-        shape* shape1;
-        shape* shape2;
         
+        // last result of the pair and its transition from the one before
+        bool touching;
+        timediff toi;
+        collision::contact state;
+        
+        // inputs of the last narrowphase check. valid is false until the
+        // pair is first checked
+        bool valid;
+        timediff cached_dt;
+        body body1, body2;
+        aabb box1, box2;
+        unsigned int revision1, revision2;
+        
+        // impulse the response solved the contact with last frame, zero
+        // while the shapes don't touch
+        float impulse;
+        
+        // shapes are stored ordered by id, so both orders of a pair
+        // are the same interaction
         interaction(shape* shape1, shape* shape2)
-        : update_timestamp(-1), shape1(shape1), shape2(shape2)
+        : pairrecord(shape1->id < shape2->id ? shape1 : shape2, shape1->id < shape2->id ? shape2 : shape1),
+          update_timestamp(-1), touching(false), toi(0), state(collision::none), valid(false), cached_dt(0),
+          revision1(0), revision2(0), impulse(0)
         {
-          interactions_changed = true;
         }
         
-        // operator implemented for the set template class comparison
-        bool operator<(const interaction& other) const {
-          // an interaction is equal to another if both have the same shapes
-          return (!((shape1 == other.shape1 && shape2 == other.shape2) ||
-                    (shape1 == other.shape2 && shape2 == other.shape1)));
+        // key of the interaction in the pair table
+        uint64_t key() const {
+          return pairtable<interaction>::key(shape1->id, shape2->id);
         }
         
-        // checks collision between the pair of shapes
-        void checkcollision(timediff dt) {
-          bool collides = shape1->checkcollision(dt, shape2);
+        // interpolation steps the pair takes this frame. fixed by the scene
+        // or, in adaptive mode, as many as the relative motion needs
+        int substeps(timediff dt) const {
+          if (!adaptive)
+            return interpolation_steps;
+          return shape1->substeps(dt, bodies[shape1->bodyid], shape2, bodies[shape2->bodyid], interpolation_steps);
+        }
+        
+        // checks collision between the pair of shapes. reads only the
+        // frame snapshots and changes nothing, so the worker threads may
+        // check many pairs at once
+        bool checkcollision(timediff dt, int steps, timediff& toi) const {
+          const body& body1 = bodies[shape1->bodyid];
+          const body& body2 = bodies[shape2->bodyid];
+          if (continuous)
+            return shape1->timeofimpact(dt, body1, shape2, body2, steps, toi);
+          return shape1->checkcollision(dt, body1, shape2, body2, steps, toi);
+        }
+        
+        // true if neither shape moved nor changed since the last check, so
+        // its result still holds. the swept bounds capture shape position
+        // and size, the revisions the geometry within the bounds, as a
+        // rotation that keeps them, and the bodies the motion
+        bool unchanged(timediff dt) const {
+          return (
+            valid && dt == cached_dt &&
+            bodies[shape1->bodyid] == body1 && bodies[shape2->bodyid] == body2 &&
+            shape1->box == box1 && shape2->box == box2 &&
+            shape1->revision == revision1 && shape2->revision == revision2
+          );
+        }
+        
+        // records the inputs of the check about to run
+        void cache(timediff dt) {
+          valid = true;
+          cached_dt = dt;
+          body1 = bodies[shape1->bodyid];
+          body2 = bodies[shape2->bodyid];
+          box1 = shape1->box;
+          box2 = shape2->box;
+          revision1 = shape1->revision;
+          revision2 = shape2->revision;
+        }
+        
+        // receives the narrowphase result of the pair, either from
+        // checkcollision, from the batch kernels or from the cache. always
+        // called from the update thread, in the same order whatever the
+        // thread count
+        void collided(bool collides, timediff toi) {
+          if (collides)
+            state = touching ? collision::stay : collision::begin;
+          else
+            state = touching ? collision::end : collision::none;
+          touching = collides;
+          this->toi = toi;
           
-          // triggers the collision event
+          // triggers the collision event on both objects
+          if (state != collision::none && dispatching) {
+            ((collider*)shape1->getowner())->record(state, shape1, shape2, toi);
+            ((collider*)shape2->getowner())->record(state, shape2, shape1, toi);
+          }
+        }
+    };
+    
+    // spatial queries of the collider.world parameter. candidates come from
+    // the broadphase and the resting tree and are tested at their current
+    // positions
+    class spatialqueries : public collisionworld {
+      private:
+        // ray hits of a query along with the index of their ray
+        typedef pair<int, queryhit> indexedhit;
+        
+        // orders the hits by ray, then by distance. ties go to the oldest
+        // shape, so the results don't depend on the broadphase order
+        struct closest {
+          bool operator()(const indexedhit& a, const indexedhit& b) const {
+            if (a.first != b.first)
+              return a.first < b.first;
+            if (a.second.t != b.second.t)
+              return a.second.t < b.second.t;
+            return a.second.sh->id < b.second.sh->id;
+          }
+        };
+        
+        // scratch lists, kept to avoid allocations on every query
+        vector<shape*> queried;
+        vector< pair<int, shape*> > crossed;
+        vector<indexedhit> casthits;
+        hitlist first;
+        
+      public:
+        void overlappoint(const vec2& point, hitlist& hits, unsigned int mask) {
+          overlapcircle(point, 0, hits, mask);
+        }
+        
+        void overlapbox(const vec2& min, const vec2& max, hitlist& hits, unsigned int mask) {
+          aabb box(min.x, min.y, max.x, max.y);
+          gather(box);
+          for (size_t i = 0; i < queried.size(); i++) {
+            shape* sh = queried[i];
+            if ((sh->layer & mask) && sh->overlaps(position(sh), box))
+              hits.push_back(hitof(sh));
+          }
+        }
+        
+        void overlapcircle(const vec2& center, float radius, hitlist& hits, unsigned int mask) {
+          gather(aabb(center.x - radius, center.y - radius, center.x + radius, center.y + radius));
+          for (size_t i = 0; i < queried.size(); i++) {
+            shape* sh = queried[i];
+            if ((sh->layer & mask) && sh->overlaps(position(sh), center, radius))
+              hits.push_back(hitof(sh));
+          }
+        }
+        
+        bool raycast(const ray& r, queryhit& hit, unsigned int mask) {
+          raycast(&r, 1, first, mask);
+          hit = first[0];
+          return hit.sh != 0;
+        }
+        
+        void raycastall(const ray& r, hitlist& hits, unsigned int mask) {
+          cast(&r, 1, mask);
+          for (size_t k = 0; k < casthits.size(); k++)
+            hits.push_back(casthits[k].second);
+        }
+        
+        void raycast(const ray* rays, int count, hitlist& hits, unsigned int mask) {
+          cast(rays, count, mask);
+          hits.assign(count, hitof(0));
+          for (size_t k = 0; k < casthits.size(); k++) {
+            queryhit& hit = hits[casthits[k].first];
+            if (!hit.sh)
+              hit = casthits[k].second;
+          }
+        }
+        
+        void raycastall(const ray* rays, int count, hitlist& hits, vector<int>& offsets, unsigned int mask) {
+          cast(rays, count, mask);
+          hits.clear();
+          offsets.assign(count + 1, 0);
+          for (size_t k = 0; k < casthits.size(); k++) {
+            hits.push_back(casthits[k].second);
+            offsets[casthits[k].first + 1]++;
+          }
+          for (int i = 0; i < count; i++)
+            offsets[i + 1] += offsets[i];
+        }
+        
+      private:
+        // shapes of both structures whose boxes overlap box
+        void gather(const aabb& box) {
+          queried.clear();
+          if (pairfinder)
+            pairfinder->query(box, queried);
+          if (restingtree)
+            restingtree->query(box, queried);
+        }
+        
+        // hits of every ray, sorted by ray and distance
+        void cast(const ray* rays, int count, unsigned int mask) {
+          crossed.clear();
+          if (pairfinder)
+            pairfinder->raycast(rays, count, crossed);
+          if (restingtree)
+            restingtree->raycast(rays, count, crossed);
           
+          casthits.clear();
+          for (size_t k = 0; k < crossed.size(); k++) {
+            const ray& r = rays[crossed[k].first];
+            shape* sh = crossed[k].second;
+            float t;
+            vec2 normal;
+            if (!(sh->layer & mask) || !sh->raycast(position(sh), r.from, r.to, t, normal))
+              continue;
+            
+            queryhit hit = hitof(sh);
+            hit.t = t;
+            hit.point = madd(r.from, r.to - r.from, t);
+            hit.normal = normal;
+            casthits.push_back(make_pair(crossed[k].first, hit));
+          }
+          sort(casthits.begin(), casthits.end(), closest());
+        }
+        
+        static queryhit hitof(shape* sh) {
+          queryhit hit;
+          hit.collider = sh ? sh->getowner() : 0;
+          hit.sh = sh;
+          hit.t = 0;
+          hit.point = vec2(0, 0);
+          hit.normal = vec2(0, 0);
+          return hit;
         }
     };
     
     static set<collider*> colliders;
-    static set<interaction> interactions;
+    static pool<interaction> interactionpool;
+    static pairtable<interaction> interactions;
     static int update_timestamp;
     
-    set<shape*> shapes;
+    // true while the collision checks of the frame run. contacts ended by
+    // removing a shape outside of it are not reported, as the shape is gone
+    static bool dispatching;
+    
+    // kinematic snapshots of all colliders, taken once per frame
+    static vector<body> bodies;
+    
+    // continuous collision detection, from the collider.continuous scene
+    // parameter. solves the time of impact instead of interpolating
+    static bool continuous;
+    
+    // interpolation steps of the narrowphase, from the
+    // collider.interpolation_steps scene parameter. in adaptive mode, set by
+    // collider.adaptive, it only caps the steps each pair computes for itself
+    static int interpolation_steps;
+    static bool adaptive;
+    
+    // culls the shape pairs that can't collide before the narrowphase
+    static broadphase* pairfinder;
+    static broadphase::pairlist candidates;
+    
+    // static and sleeping shapes. only queried by the awake shapes, so
+    // resting pairs are never tested
+    static aabbtree* restingtree;
+    static vector<shape*> found;
+    
+    // the spatial queries, shared by every collider
+    static spatialqueries world;
+    
+    // frames an object must stay still before falling asleep, from the
+    // collider.sleepframes scene parameter. 0 disables sleeping
+    static int sleepframes;
+    
+    // pairs of the shape types with batched narrowphase kernels, the
+    // interactions they belong to and the kernel results
+    static circlepairs circlebatch;
+    static rectanglepairs rectanglebatch;
+    static vector<interaction*> circleinteractions;
+    static vector<interaction*> rectangleinteractions;
+    static vector<unsigned int> hits;
+    static vector<timediff> times;
+    
+    // pairs checked one by one and the steps each takes
+    static vector<interaction*> scalarinteractions;
+    static vector<int> scalarsteps;
+    
+    // runs the scalar checks in parallel, from the collider.threads scene
+    // parameter. null when the checks run on the update thread. each worker
+    // records its hits, as pair index and time, in its own buffer
+    static workerpool* workers;
+    static vector< vector< pair<int, timediff> > > workerhits;
+    static vector< pair<int, timediff> > mergedhits;
+    
+    // collision response, from the collider.response scene parameter. the
+    // touching pairs are solved as contacts over collider.iterations
+    // iterations, bouncing by collider.restitution, and the corrected
+    // speeds written back to the objects. velocities are indexed by body
+    static bool response;
+    static int iterations;
+    static float restitution;
+    static contactsolver solver;
+    static vector<interaction*> contactinteractions;
+    static vector<vec2> velocities;
+    
+    // records the input of every frame to the file named by the
+    // collider.record scene parameter, for collider_replay
+    static framerecorder recorder;
+    
+    // scene parameters, as the recording stores them
+    static const char* const sceneparameters[];
+    
+    // counters of the frame, published every frame as collider.stats.*
+    // on the colliders whose collider.stats parameter is set. the stage
+    // clock and the histogram dump only run while there is one of those
+    static collisionstats stats;
+    static stageclock stopwatch;
+    static statshistogram histogram;
+    static set<collider*> profilers;
+    static vector<string> statnames;
+    static vector<int> statvalues;
+    
+    vector<shape*> shapes;
+    
+    // stats parameters of the object, if it asked for them
+    vector< gear2d::link<int> > statparams;
+    
+    // object kinematics, copied to the snapshot of the frame
+    gear2d::link<float> x0, y0;
+    gear2d::link<float> xspeed, yspeed;
+    gear2d::link<float> xaccel, yaccel;
+    
+    // events of the object in the frame. the list is cleared, not freed,
+    // every frame, so once it reaches the largest frame it never allocates
+    collisionlist events;
+    gear2d::link<const collisionlist*> collisions;
+    
+    // identifies the object along a recording
+    const unsigned int id;
+    
+    // the collider.static parameter makes every shape of the object static
+    bool fixed;
+    
+    // inverse of the collider.mass parameter, zero for static objects so
+    // the response never moves them
+    float inversemass;
+    
+    // sleep state. restframes counts the frames the object stood still and
+    // disturbed is set when its position is written to a new place
+    bool asleep;
+    int restframes;
+    bool disturbed;
+    float lastx, lasty;
     
   public:
     // constructor and destructor
-    collider() {
+    collider()
+    : id(newid()), fixed(false), inversemass(1), asleep(false), restframes(0), disturbed(false), lastx(0), lasty(0)
+    {
       colliders.insert(this);
     }
     ~collider() {
       // frees all collider shapes
       while (shapes.size()) {
-        freeshape(*shapes.begin());
-        shapes.erase(shapes.begin());
+        freeshape(shapes.back());
+        shapes.pop_back();
       }
       
       colliders.erase(this);
+      profilers.erase(this);
+      if (colliders.empty()) {
+        delete pairfinder;
+        pairfinder = 0;
+        delete restingtree;
+        restingtree = 0;
+        delete workers;
+        workers = 0;
+      }
     }
     
     virtual gear2d::component::family family() { return "collider"; }
@@ -68,6 +403,65 @@ class collider : public component::base {
     
     // setup phase, to initialize paramters and other stuff
     virtual void setup(object::signature & sig) {
+      // the first collider of the scene reads the scene parameters and
+      // creates the broadphase
+      if (!pairfinder) {
+        continuous = (sig["collider.continuous"] == "true" || sig["collider.continuous"] == "1");
+        adaptive = (sig["collider.adaptive"] == "true" || sig["collider.adaptive"] == "1");
+        interpolation_steps = eval<int>(sig["collider.interpolation_steps"]);
+        if (interpolation_steps < 1)
+          interpolation_steps = 1;
+        pairfinder = createbroadphase(sig);
+        restingtree = new aabbtree(0, 0);
+        
+        if (sig["collider.sleepframes"] != "")
+          sleepframes = eval<int>(sig["collider.sleepframes"]);
+        
+        response = (sig["collider.response"] == "true" || sig["collider.response"] == "1");
+        if (sig["collider.iterations"] != "")
+          iterations = std::max(eval<int>(sig["collider.iterations"]), 1);
+        restitution = std::max(eval<float>(sig["collider.restitution"]), 0.0f);
+        
+        string path = sig["collider.record"];
+        if (path != "" && !recorder.open(path, settings(sig)))
+          trace("Could not open the collider recording file");
+        
+        int threads = eval<int>(sig["collider.threads"]);
+        if (threads > 1)
+          workers = new workerpool(threads);
+        workerhits.resize(workers ? workers->size() : 1);
+      }
+      
+      x0 = fetch<float>("x");
+      y0 = fetch<float>("y");
+      xspeed = fetch<float>("x.speed");
+      yspeed = fetch<float>("y.speed");
+      xaccel = fetch<float>("x.accel");
+      yaccel = fetch<float>("y.accel");
+      
+      write<const collisionlist*>("collider.collisions", &events);
+      collisions = fetch<const collisionlist*>("collider.collisions");
+      write<collisionworld*>("collider.world", &world);
+      
+      fixed = (sig["collider.static"] == "true" || sig["collider.static"] == "1");
+      float mass = sig["collider.mass"] != "" ? eval<float>(sig["collider.mass"]) : 1;
+      inversemass = (fixed || mass <= 0) ? 0 : 1/mass;
+      
+      // a histogram file turns the stats on as well, as collider.stats
+      // can't hold a value next to the parameters under it in yaml
+      bool profiled = (sig["collider.stats"] == "true" || sig["collider.stats"] == "1");
+      if (profiled || sig["collider.stats.histogram"] != "")
+        profile(sig);
+      lastx = x0;
+      lasty = y0;
+      hook("x");
+      hook("y");
+      
+      // the collider gets a snapshot right away, in case it was created in
+      // the middle of a frame
+      bodies.push_back(body());
+      snapshot(bodies.size() - 1);
+      
       set<string> shape_names;
       split(shape_names, sig["collider.shapes"], ' ');
       
@@ -77,37 +471,268 @@ class collider : public component::base {
       }
     }
     
+    static unsigned int newid() {
+      static unsigned int next = 0;
+      return next++;
+    }
+    
+    // the scene parameters set in sig, one "name=value" line each
+    static string settings(object::signature & sig) {
+      string lines;
+      for (int i = 0; sceneparameters[i]; i++) {
+        string value = sig[sceneparameters[i]];
+        if (value != "")
+          lines += string(sceneparameters[i]) + "=" + value + "\n";
+      }
+      return lines;
+    }
+    
+    // appends the snapshots and shapes of every collider to the recording
+    static void recordframe(timediff dt, int frame) {
+      recorder.begin(frame, dt);
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        if ((*c)->shapes.empty())
+          continue;
+        const body& b = bodies[(*c)->shapes.front()->bodyid];
+        int object = recorder.object((*c)->id, (*c)->fixed, (*c)->inversemass ? 1/(*c)->inversemass : 0, b);
+        for (vector<shape*>::iterator s = (*c)->shapes.begin(); s != (*c)->shapes.end(); ++s)
+          recorder.add(object, *s);
+      }
+      recorder.end();
+    }
+    
+    // copies the object kinematics to the snapshot at index
+    void snapshot(int index) {
+      body& b = bodies[index];
+      b.x = x0;
+      b.y = y0;
+      b.xspeed = xspeed;
+      b.yspeed = yspeed;
+      b.xaccel = xaccel;
+      b.yaccel = yaccel;
+      
+      // a resting shape whose geometry changed is handled as if the
+      // object was moved
+      for (vector<shape*>::iterator s = shapes.begin(); s != shapes.end(); ++s) {
+        (*s)->bodyid = index;
+        if (!(*s)->prepare())
+          continue;
+        (*s)->revision++;
+        if ((*s)->resting)
+          disturbed = true;
+      }
+    }
+    
+    // creates the stats parameters of the object. the first collider to
+    // name a collider.stats.histogram file starts the histogram dump, over
+    // collider.stats.window frames every collider.stats.period frames
+    void profile(object::signature & sig) {
+      if (statnames.empty())
+        collisionstats::names(statnames);
+      for (size_t i = 0; i < statnames.size(); i++) {
+        write<int>("collider.stats." + statnames[i], 0);
+        statparams.push_back(fetch<int>("collider.stats." + statnames[i]));
+      }
+      profilers.insert(this);
+      
+      string path = sig["collider.stats.histogram"];
+      if (path != "" && !histogram.active()) {
+        int window = eval<int>(sig["collider.stats.window"]);
+        int period = eval<int>(sig["collider.stats.period"]);
+        if (!histogram.open(path, window > 0 ? window : 600, period > 0 ? period : 60))
+          trace("Could not open the collider stats histogram file");
+      }
+    }
+    
+    // writes the counters of the frame to the stats parameters
+    static void publishstats(int frame) {
+      for (size_t i = 0; i < interactions.size(); i++) {
+        if (interactions[i]->touching)
+          stats.hits++;
+      }
+      
+      statvalues.clear();
+      stats.values(statvalues);
+      for (set<collider*>::iterator c = profilers.begin(); c != profilers.end(); ++c) {
+        for (size_t i = 0; i < statvalues.size(); i++)
+          (*c)->statparams[i] = statvalues[i];
+      }
+      if (histogram.active())
+        histogram.add(stats, frame);
+    }
+    
+    // position of a shape right now, which the queries test against
+    static vec2 position(const shape* sh) {
+      const collider* c = (const collider*)sh->getowner();
+      body b = body();
+      b.x = c->x0;
+      b.y = c->y0;
+      return sh->getpos(b, 0);
+    }
+    
+    // appends an event of the object
+    void record(collision::contact state, const shape* self, const shape* other, timediff toi) {
+      collision c;
+      c.state = state;
+      c.collider = this;
+      c.self = self;
+      c.othercollider = other->getowner();
+      c.other = other;
+      c.toi = toi;
+      events.push_back(c);
+    }
+    
+    // position writes that move the object wake it up on the next update
+    virtual void handle(parameterbase::id, component::base*, object::id) {
+      if (x0 != lastx || y0 != lasty)
+        disturbed = true;
+    }
+    
+    // updates the sleep state of the object from its snapshot. objects
+    // without speed nor acceleration that were not moved fall asleep after
+    // sleepframes frames, and any motion wakes them
+    void rest() {
+      const body& b = bodies[(*shapes.begin())->bodyid];
+      bool still = !disturbed && !b.xspeed && !b.yspeed && !b.xaccel && !b.yaccel;
+      
+      // static shapes are moved in place when the object is
+      if (disturbed) {
+        for (vector<shape*>::iterator s = shapes.begin(); s != shapes.end(); ++s) {
+          if ((*s)->fixed) {
+            (*s)->box = (*s)->sweptbounds(b, 0);
+            restingtree->move(*s, (*s)->box, vec2(0, 0));
+          }
+        }
+      }
+      disturbed = false;
+      lastx = b.x;
+      lasty = b.y;
+      
+      if (!still) {
+        restframes = 0;
+        if (asleep)
+          wake();
+      } else if (!asleep && sleepframes > 0 && ++restframes >= sleepframes)
+        sleep();
+    }
+    
+    // moves the dynamic shapes of the object to the resting tree
+    void sleep() {
+      for (vector<shape*>::iterator s = shapes.begin(); s != shapes.end(); ++s) {
+        if ((*s)->fixed)
+          continue;
+        pairfinder->remove(*s);
+        restingtree->insert(*s, (*s)->box);
+        (*s)->resting = true;
+      }
+      asleep = true;
+    }
+    
+    // moves the dynamic shapes of the object back to the broadphase
+    void wake() {
+      for (vector<shape*>::iterator s = shapes.begin(); s != shapes.end(); ++s) {
+        if ((*s)->fixed)
+          continue;
+        restingtree->remove(*s);
+        (*s)->box = (*s)->sweptbounds(bodies[(*s)->bodyid], 0);
+        pairfinder->insert(*s, (*s)->box);
+        (*s)->resting = false;
+      }
+      asleep = false;
+      restframes = 0;
+    }
+    
+    // creates the broadphase chosen by the collider.broadphase scene
+    // parameter: "sap" (default), "tree" or "grid", which uses collider.cellsize
+    static broadphase* createbroadphase(object::signature & sig) {
+      moderr("collider");
+      
+      string type = sig["collider.broadphase"];
+      if (type == "grid") {
+        float cellsize = eval<float>(sig["collider.cellsize"]);
+        if (cellsize <= 0)
+          cellsize = 64;
+        return new spatialhash(cellsize);
+      }
+      
+      if (type == "tree")
+        return new aabbtree();
+      
+      if (type != "" && type != "sap")
+        trace("Unknown broadphase type inside collider component, using sap");
+      return new sweepandprune();
+    }
+    
     // looks for a shape type and calls the correct constructor
     void loadshape(object::signature & sig, const string& shape_name) {
       moderr("collider");
       
       string type = sig["collider." + shape_name + ".type"];
       
+      shape* sh = 0;
       try {
-        if (type == "rectangle")
-          shapes.insert(new rectangle(this, sig, shape_name));
-        else if (type == "circle")
-          shapes.insert(new circle(this, sig, shape_name));
+        const char* const* name = std::find(shapenames, shapenames + shapetypes::size, type);
+        if (name != shapenames + shapetypes::size)
+          sh = shapefactories<shapetypes>::make[name - shapenames](this, sig, shape_name);
         else
           trace("Unknown geometrical shape type creation inside collider component");
       }
       catch (evil& e) {
         trace(e.what());
       }
+      
+      if (sh) {
+        sh->bodyid = bodies.size() - 1;
+        stats.added++;
+        shapes.push_back(sh);
+        sh->box = sh->sweptbounds(bodies[sh->bodyid], 0);
+        sh->fixed = fixed || sig["collider." + shape_name + ".static"] == "true" || sig["collider." + shape_name + ".static"] == "1";
+        sh->resting = sh->fixed || asleep;
+        if (sh->resting)
+          restingtree->insert(sh, sh->box);
+        else
+          pairfinder->insert(sh, sh->box);
+      }
     }
     
-    // frees all interactions related to a shape and the shape itself
+    // frees all interactions related to a shape and the shape itself.
+    // only the pairs of the shape are visited
     void freeshape(shape* sh) {
-      set<interaction>::iterator it = interactions.begin(), ittmp;
-      while (it != interactions.end()) {
-        ittmp = it;
-        ++it;
-        if (ittmp->shape1 == sh || ittmp->shape2 == sh)
-          interactions.erase(ittmp);
+      while (sh->pairs.size()) {
+        interaction* i = static_cast<interaction*>(sh->pairs.back());
+        i->collided(false, 0);
+        drop(i);
       }
+      if (sh->resting)
+        restingtree->remove(sh);
+      else
+        pairfinder->remove(sh);
+      stats.removed++;
       delete sh;
     }
     
+    // interaction of a pair of shapes, created on its first lookup
+    interaction* find(shape* shape1, shape* shape2) {
+      uint64_t key = pairtable<interaction>::key(shape1->id, shape2->id);
+      interaction* found = interactions.find(key);
+      if (found)
+        return found;
+      
+      interaction* created = interactionpool.create(shape1, shape2);
+      interactions.insert(key, created);
+      created->shape1->attach(created);
+      created->shape2->attach(created);
+      return created;
+    }
+    
+    // removes an interaction from the index and from its shapes
+    void drop(interaction* i) {
+      interactions.erase(i->key());
+      i->shape1->detach(i);
+      i->shape2->detach(i);
+      interactionpool.destroy(i);
+    }
+    
     // runs the big loop to check collision between alls pairs of interaction
     virtual void update(timediff dt, int begin) {
       // avoiding collider component update more than once by frame
@@ -115,36 +740,326 @@ class collider : public component::base {
         return;
       update_timestamp = begin;
       
-      // globalupdate function is called until it doesn't create any interaction
-      do {
-        interaction::interactions_changed = false;
-        globalupdate(dt, begin);
-      } while (interaction::interactions_changed);
+      bool profiling = !profilers.empty();
+      if (profiling)
+        stopwatch.start();
+      
+      // takes the kinematic snapshot of every collider, which is all the
+      // pair tests of this frame will read
+      bodies.resize(colliders.size());
+      int index = 0;
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c)
+        (*c)->snapshot(index++);
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        if ((*c)->shapes.size())
+          (*c)->rest();
+        (*c)->events.clear();
+      }
+      if (recorder.active())
+        recordframe(dt, begin);
+      if (profiling)
+        stopwatch.lap(stats, collisionstats::snapshot);
+      
+      dispatching = true;
+      
+      // collision handlers run after the checks, once the events are
+      // published, so a single pass sees every shape of the frame
+      globalupdate(dt, begin, profiling);
+      
+      if (response) {
+        respond(dt, begin);
+        if (profiling)
+          stopwatch.lap(stats, collisionstats::response);
+      }
+      
+      // drops the interactions whose shapes are no longer close, ending
+      // the contact of those still touching. resting pairs are not checked,
+      // so those touching keep their contact. dropping moves the last
+      // interaction to the current place, which is then visited again
+      size_t i = 0;
+      while (i < interactions.size()) {
+        interaction* tmp = interactions[i];
+        if (tmp->update_timestamp == begin) {
+          i++;
+          continue;
+        }
+        
+        if (tmp->touching && tmp->shape1->resting && tmp->shape2->resting) {
+          tmp->update_timestamp = begin;
+          tmp->collided(true, tmp->toi);
+          i++;
+        } else {
+          tmp->collided(false, 0);
+          drop(tmp);
+        }
+      }
+      
+      dispatching = false;
+      
+      // publishes the events, a single write per object that collided
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        if ((*c)->events.size())
+          (*c)->collisions = &(*c)->events;
+      }
+      
+      if (profiling) {
+        stopwatch.lap(stats, collisionstats::events);
+        for (int s = 0; s < collisionstats::total; s++)
+          stats.times[collisionstats::total] += stats.times[s];
+        publishstats(begin);
+      }
+      stats.clear();
     }
     
-    // check all collision interactions
-    void globalupdate(timediff dt, int begin) {
-      for (set<interaction>::iterator it = interactions.begin(); it != interactions.end(); ++it) {
-        interaction& tmp = (interaction&)*it;
+    // check the collision interactions of all shape pairs the broadphase
+    // could not cull
+    void globalupdate(timediff dt, int begin, bool profiling) {
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        for (vector<shape*>::iterator s = (*c)->shapes.begin(); s != (*c)->shapes.end(); ++s) {
+          if ((*s)->resting)
+            continue;
+          const body& b = bodies[(*s)->bodyid];
+          (*s)->box = (*s)->sweptbounds(b, dt);
+          pairfinder->move(*s, (*s)->box, (*s)->displacement(b, dt));
+        }
+      }
+      
+      candidates.clear();
+      pairfinder->collect(candidates);
+      
+      // awake shapes against the resting ones
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        for (vector<shape*>::iterator s = (*c)->shapes.begin(); s != (*c)->shapes.end(); ++s) {
+          if ((*s)->resting)
+            continue;
+          found.clear();
+          restingtree->query((*s)->box, found);
+          for (size_t i = 0; i < found.size(); i++) {
+            if ((*s)->interacts(found[i]))
+              candidates.push_back(make_pair(*s, found[i]));
+          }
+        }
+      }
+      
+      stats.candidates += candidates.size();
+      if (profiling)
+        stopwatch.lap(stats, collisionstats::broadphase);
+      
+      circlebatch.clear();
+      rectanglebatch.clear();
+      circleinteractions.clear();
+      rectangleinteractions.clear();
+      scalarinteractions.clear();
+      scalarsteps.clear();
+      
+      for (broadphase::pairlist::iterator pair = candidates.begin(); pair != candidates.end(); ++pair) {
+        interaction& tmp = *find(pair->first, pair->second);
         
         // avoiding collision interaction check more than once by frame
         if (tmp.update_timestamp == begin)
           continue;
         tmp.update_timestamp = begin;
+        stats.pairs++;
+        
+        // pairs at rest keep the result of the last check
+        if (tmp.unchanged(dt)) {
+          tmp.collided(tmp.touching, tmp.toi);
+          stats.cached++;
+          continue;
+        }
+        tmp.cache(dt);
+        
+        // pairs of the same batched type are gathered for the kernels, the
+        // others check collision right away. the kernels interpolate, so
+        // continuous detection doesn't use them. all pairs of a batch take
+        // the same steps, so in adaptive mode only the pairs that need a
+        // single step are batched
+        shape* s1 = tmp.shape1;
+        shape* s2 = tmp.shape2;
+        stats.tests[std::min(s1->type, s2->type)][std::max(s1->type, s2->type)]++;
+        int steps = tmp.substeps(dt);
+        if (continuous || (adaptive && steps > 1)) {
+          scalarinteractions.push_back(&tmp);
+          scalarsteps.push_back(steps);
+        } else if (s1->type == s2->type && s1->type == typeindex<circle, shapetypes>::value) {
+          circlebatch.add(*(circle*)s1, bodies[s1->bodyid], *(circle*)s2, bodies[s2->bodyid]);
+          circleinteractions.push_back(&tmp);
+        } else if (s1->type == s2->type && s1->type == typeindex<rectangle, shapetypes>::value) {
+          rectanglebatch.add(*(rectangle*)s1, bodies[s1->bodyid], *(rectangle*)s2, bodies[s2->bodyid]);
+          rectangleinteractions.push_back(&tmp);
+        } else {
+          scalarinteractions.push_back(&tmp);
+          scalarsteps.push_back(steps);
+        }
+      }
+      
+      scalarcheck(dt);
+      
+      // lanes that miss leave their time unset, a miss gets toi 0 as on
+      // the scalar path
+      int batchsteps = adaptive ? 1 : interpolation_steps;
+      batch::test(circlebatch, dt, batchsteps, hits, times);
+      for (size_t i = 0; i < circleinteractions.size(); i++) {
+        bool hit = (hits[i >> 5] >> (i & 31)) & 1;
+        circleinteractions[i]->collided(hit, hit ? times[i] : 0);
+      }
+      
+      batch::test(rectanglebatch, dt, batchsteps, hits, times);
+      for (size_t i = 0; i < rectangleinteractions.size(); i++) {
+        bool hit = (hits[i >> 5] >> (i & 31)) & 1;
+        rectangleinteractions[i]->collided(hit, hit ? times[i] : 0);
+      }
+      
+      if (profiling)
+        stopwatch.lap(stats, collisionstats::narrowphase);
+    }
+    
+    // solves the pairs touching this frame as contacts, at the time they
+    // touched, and writes the corrected speeds once per object whose speed
+    // changed. pairs that stopped touching forget their impulse
+    void respond(timediff dt, int begin) {
+      solver.clear();
+      contactinteractions.clear();
+      for (size_t i = 0; i < interactions.size(); i++) {
+        interaction* tmp = interactions[i];
+        if (tmp->update_timestamp != begin || !tmp->touching) {
+          tmp->impulse = 0;
+          continue;
+        }
         
-        // checks collision
-        tmp.checkcollision(dt);
+        shape* s1 = tmp->shape1;
+        shape* s2 = tmp->shape2;
+        float inversemass1 = s1->fixed ? 0 : ((collider*)s1->getowner())->inversemass;
+        float inversemass2 = s2->fixed ? 0 : ((collider*)s2->getowner())->inversemass;
+        vec2 normal;
+        float depth;
+        if (inversemass1 + inversemass2 <= 0 || !s1->contact(
+          s1->getpos(bodies[s1->bodyid], tmp->toi), s2, s2->getpos(bodies[s2->bodyid], tmp->toi), normal, depth
+        )) {
+          tmp->impulse = 0;
+          continue;
+        }
+        solver.add(s1->bodyid, inversemass1, s2->bodyid, inversemass2, normal, depth, tmp->impulse);
+        contactinteractions.push_back(tmp);
+      }
+      stats.contacts = solver.size();
+      if (!solver.size())
+        return;
+      
+      velocities.resize(bodies.size());
+      for (size_t b = 0; b < bodies.size(); b++)
+        velocities[b] = vec2(bodies[b].xspeed, bodies[b].yspeed);
+      solver.prepare(dt, restitution, velocities);
+      solver.solve(iterations, velocities);
+      for (size_t c = 0; c < contactinteractions.size(); c++)
+        contactinteractions[c]->impulse = solver.impulse(c);
+      
+      // colliders created by the checks of this frame took their body
+      // after the snapshots, so the body of a collider is found through its
+      // shapes
+      for (set<collider*>::iterator c = colliders.begin(); c != colliders.end(); ++c) {
+        if ((*c)->shapes.empty())
+          continue;
+        int id = (*c)->shapes.front()->bodyid;
+        const body& b = bodies[id];
+        const vec2& v = velocities[id];
+        if (v.x != b.xspeed)
+          (*c)->xspeed = v.x;
+        if (v.y != b.yspeed)
+          (*c)->yspeed = v.y;
+      }
+    }
+    
+    // checks the scalar pairs, spread over the workers if there are any.
+    // the hits are merged back in pair order, so the results reach the
+    // interactions in the same order whatever the thread count
+    void scalarcheck(timediff dt) {
+      workerpool::job job = [dt](int worker, int begin, int end) {
+        vector< pair<int, timediff> >& found = workerhits[worker];
+        for (int i = begin; i < end; i++) {
+          timediff toi = 0;
+          if (scalarinteractions[i]->checkcollision(dt, scalarsteps[i], toi))
+            found.push_back(make_pair(i, toi));
+        }
+      };
+      
+      for (size_t w = 0; w < workerhits.size(); w++)
+        workerhits[w].clear();
+      
+      int count = scalarinteractions.size();
+      if (workers)
+        workers->run(count, 64, job);
+      else
+        job(0, 0, count);
+      
+      mergedhits.clear();
+      for (size_t w = 0; w < workerhits.size(); w++)
+        mergedhits.insert(mergedhits.end(), workerhits[w].begin(), workerhits[w].end());
+      sort(mergedhits.begin(), mergedhits.end());
+      
+      size_t next = 0;
+      for (int i = 0; i < count; i++) {
+        if (next < mergedhits.size() && mergedhits[next].first == i)
+          scalarinteractions[i]->collided(true, mergedhits[next++].second);
+        else
+          scalarinteractions[i]->collided(false, 0);
       }
     }
 };
 
 // static vars
 
-bool collider::interaction::interactions_changed = false;
 
 set<collider*> collider::colliders;
-set<collider::interaction> collider::interactions;
+pool<collider::interaction> collider::interactionpool;
+pairtable<collider::interaction> collider::interactions;
 int collider::update_timestamp = -1;
+bool collider::dispatching = false;
+bool collider::continuous = false;
+int collider::interpolation_steps = 1;
+bool collider::adaptive = false;
+vector<body> collider::bodies;
+
+broadphase* collider::pairfinder = 0;
+broadphase::pairlist collider::candidates;
+aabbtree* collider::restingtree = 0;
+vector<shape*> collider::found;
+collider::spatialqueries collider::world;
+int collider::sleepframes = 60;
+
+circlepairs collider::circlebatch;
+rectanglepairs collider::rectanglebatch;
+vector<collider::interaction*> collider::circleinteractions;
+vector<collider::interaction*> collider::rectangleinteractions;
+vector<unsigned int> collider::hits;
+vector<timediff> collider::times;
+vector<collider::interaction*> collider::scalarinteractions;
+vector<int> collider::scalarsteps;
+
+workerpool* collider::workers = 0;
+vector< vector< pair<int, timediff> > > collider::workerhits;
+vector< pair<int, timediff> > collider::mergedhits;
+
+bool collider::response = false;
+int collider::iterations = 4;
+float collider::restitution = 0;
+contactsolver collider::solver;
+vector<collider::interaction*> collider::contactinteractions;
+vector<vec2> collider::velocities;
+
+framerecorder collider::recorder;
+const char* const collider::sceneparameters[] = {
+  "collider.broadphase", "collider.cellsize", "collider.continuous", "collider.adaptive",
+  "collider.interpolation_steps", "collider.threads", "collider.sleepframes",
+  "collider.response", "collider.iterations", "collider.restitution", 0
+};
+
+collisionstats collider::stats;
+stageclock collider::stopwatch;
+statshistogram collider::histogram;
+set<collider*> collider::profilers;
+vector<string> collider::statnames;
+vector<int> collider::statvalues;
 
 // the build function
 g2dcomponent(collider)
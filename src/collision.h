@@ -0,0 +1,42 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <vector>
+#include "gear2d.h"
+
+using namespace gear2d;
+
+class shape;
+
+// collision event, as seen by one of the two objects involved. the collider
+// publishes the events of an object once per frame, after its collision
+// checks, writing a pointer to its event list to the collider.collisions
+// parameter. components hook that parameter to respond to collisions.
+// the list and the shapes it points to are only valid until the next update
+// of the collider.
+struct collision {
+  // contact transition of the pair of shapes in the frame
+  enum contact {
+    none,   // apart now and on the last check
+    begin,  // started touching
+    stay,   // still touching
+    end     // stopped touching
+  };
+  
+  contact state;
+  
+  // collider and shape of the object the event was published to
+  component::base* collider;
+  const shape* self;
+  
+  // collider and shape it collided with
+  component::base* othercollider;
+  const shape* other;
+  
+  // time of impact inside the frame
+  timediff toi;
+};
+
+typedef std::vector<collision> collisionlist;
+
+#endif
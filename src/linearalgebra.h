@@ -4,6 +4,8 @@
 
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <type_traits>
 #include "gear2d.h"
 
 #undef  rad2deg
@@ -309,8 +311,20 @@ class vector3 {
       z_ = v.z_;
     }
     
-    // rotates this around other by angle degrees
+    // rotates this around the z axis by angle degrees, counterclockwise
+    // seen from positive z
+    vector3 rotatez(float angle) const {
+      float sint = std::sin(deg2rad(angle));
+      float cost = std::cos(deg2rad(angle));
+      return vector3(x_*cost - y_*sint, x_*sint + y_*cost, z_);
+    }
+    
+    // rotates this around other by angle degrees. rotations around the z
+    // axis skip the full rotation matrix
     vector3 rotate(float angle, const vector3& other) const {
+      if (!other.x_ && !other.y_ && other.z_)
+        return rotatez(other.z_ > 0 ? angle : -angle);
+      
       vector3 v;
       vector3 u = other.unitvec();
       float sint = std::sin(deg2rad(angle));
@@ -321,6 +335,11 @@ class vector3 {
       return v;
     }
     void setrotate(float angle, const vector3& other) {
+      if (!other.x_ && !other.y_ && other.z_) {
+        *this = rotatez(other.z_ > 0 ? angle : -angle);
+        return;
+      }
+      
       vector3 v;
       vector3 u = other.unitvec();
       float sint = sin(deg2rad(angle));
@@ -340,6 +359,317 @@ class vector3 {
     }
 };
 
+// lean 2d vector for the collision inner loops. unlike vector3 it caches
+// nothing, so every operation is const and constexpr where the standard
+// library allows, and it never throws: operations that would divide by
+// zero return zero instead. two floats, 8 bytes aligned, so an array of
+// them packs into simd registers.
+struct alignas(8) vec2 {
+  float x, y;
+  
+  vec2() = default;
+  constexpr vec2(float x, float y)
+  : x(x), y(y)
+  {
+  }
+  
+  // arithmetic operators
+  constexpr vec2 operator+(const vec2& other) const {
+    return vec2(x + other.x, y + other.y);
+  }
+  constexpr vec2 operator-(const vec2& other) const {
+    return vec2(x - other.x, y - other.y);
+  }
+  constexpr vec2 operator*(float scalar) const {
+    return vec2(x*scalar, y*scalar);
+  }
+  constexpr vec2 operator-() const {
+    return vec2(-x, -y);
+  }
+  vec2& operator+=(const vec2& other) {
+    x += other.x;
+    y += other.y;
+    return *this;
+  }
+  vec2& operator-=(const vec2& other) {
+    x -= other.x;
+    y -= other.y;
+    return *this;
+  }
+  vec2& operator*=(float scalar) {
+    x *= scalar;
+    y *= scalar;
+    return *this;
+  }
+  
+  // logical operators
+  constexpr bool operator==(const vec2& other) const {
+    return x == other.x && y == other.y;
+  }
+  constexpr bool operator!=(const vec2& other) const {
+    return x != other.x || y != other.y;
+  }
+  
+  // this dot other
+  constexpr float dot(const vec2& other) const {
+    return x*other.x + y*other.y;
+  }
+  
+  // z of this cross other
+  constexpr float cross(const vec2& other) const {
+    return x*other.y - y*other.x;
+  }
+  
+  // squared length, enough for comparisons without the square root
+  constexpr float length_sq() const {
+    return x*x + y*y;
+  }
+  float length() const {
+    return std::sqrt(length_sq());
+  }
+};
+
+static_assert(sizeof(vec2) == 8, "vec2 must pack two floats");
+static_assert(std::is_trivially_copyable<vec2>::value, "vec2 must be trivially copyable");
+
+constexpr vec2 operator*(float scalar, const vec2& v) {
+  return v*scalar;
+}
+
+// squared distance between a and b
+constexpr float dist_sq(const vec2& a, const vec2& b) {
+  return (a - b).length_sq();
+}
+
+// whether a and b are at most r apart, without the square root
+constexpr bool within(const vec2& a, const vec2& b, float r) {
+  return dist_sq(a, b) <= r*r;
+}
+
+// a + b*s, which compilers contract to fused multiply adds
+constexpr vec2 madd(const vec2& a, const vec2& b, float s) {
+  return vec2(a.x + b.x*s, a.y + b.y*s);
+}
+
+// p + v*t + a*t*t/2, the position of a quadratic motion at t
+constexpr vec2 motion(const vec2& p, const vec2& v, const vec2& a, float t) {
+  return madd(madd(p, v, t), a, 0.5f*t*t);
+}
+
+// unit vector of v, or zero for the zero vector. the select compiles to a
+// conditional move, so it doesn't branch
+inline vec2 normalize_or_zero(const vec2& v) {
+  float l2 = v.length_sq();
+  float inverse = l2 > 0 ? 1/std::sqrt(l2) : 0;
+  return v*inverse;
+}
+
+// 2x2 matrix, by rows:
+//   | a b |
+//   | c d |
+// like vec2 it never throws, singular matrices invert to zero
+struct mat2 {
+  float a, b;
+  float c, d;
+  
+  constexpr mat2(float a = 1, float b = 0, float c = 0, float d = 1)
+  : a(a), b(b), c(c), d(d)
+  {
+  }
+  
+  // rotation by angle degrees, counterclockwise with y up
+  static mat2 rotation(float angle) {
+    float sint = std::sin(deg2rad(angle));
+    float cost = std::cos(deg2rad(angle));
+    return mat2(cost, -sint, sint, cost);
+  }
+  
+  constexpr vec2 operator*(const vec2& v) const {
+    return vec2(a*v.x + b*v.y, c*v.x + d*v.y);
+  }
+  constexpr mat2 operator*(const mat2& m) const {
+    return mat2(a*m.a + b*m.c, a*m.b + b*m.d, c*m.a + d*m.c, c*m.b + d*m.d);
+  }
+  
+  constexpr mat2 transposed() const {
+    return mat2(a, c, b, d);
+  }
+  constexpr float determinant() const {
+    return a*d - b*c;
+  }
+  
+  // inverse of the matrix, or zero if it is singular
+  mat2 inverse() const {
+    float det = determinant();
+    float inv = det != 0 ? 1/det : 0;
+    return mat2(d*inv, -b*inv, -c*inv, a*inv);
+  }
+  
+  // x such that this*x = r. false, with x zero, if the matrix is singular
+  bool solve(const vec2& r, vec2& x) const {
+    x = inverse()*r;
+    return determinant() != 0;
+  }
+};
+
+// 3x3 matrix, by rows. used for 2d affine transforms, where the last row
+// is 0 0 1 and points carry an implicit 1 as third coordinate
+struct mat3 {
+  float m[3][3];
+  
+  mat3() {
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++)
+        m[i][j] = (i == j);
+    }
+  }
+  
+  // affine transform of a linear part and a translation
+  mat3(const mat2& linear, const vec2& translation) {
+    m[0][0] = linear.a; m[0][1] = linear.b; m[0][2] = translation.x;
+    m[1][0] = linear.c; m[1][1] = linear.d; m[1][2] = translation.y;
+    m[2][0] = 0;        m[2][1] = 0;        m[2][2] = 1;
+  }
+  
+  mat3 operator*(const mat3& other) const {
+    mat3 r;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++)
+        r.m[i][j] = m[i][0]*other.m[0][j] + m[i][1]*other.m[1][j] + m[i][2]*other.m[2][j];
+    }
+    return r;
+  }
+  
+  // transforms a point, translated, and a vector, which is not
+  vec2 point(const vec2& p) const {
+    return vec2(m[0][0]*p.x + m[0][1]*p.y + m[0][2], m[1][0]*p.x + m[1][1]*p.y + m[1][2]);
+  }
+  vec2 vector(const vec2& v) const {
+    return vec2(m[0][0]*v.x + m[0][1]*v.y, m[1][0]*v.x + m[1][1]*v.y);
+  }
+  
+  float determinant() const {
+    return
+        m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+      - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+      + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0])
+    ;
+  }
+  
+  // inverse by the adjugate, or zero if the matrix is singular
+  mat3 inverse() const {
+    float det = determinant();
+    float inv = det != 0 ? 1/det : 0;
+    mat3 r;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        // cofactor of m[j][i], from the rows and columns after them
+        int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+        int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+        r.m[i][j] = (m[r0][c0]*m[r1][c1] - m[r0][c1]*m[r1][c0])*inv;
+      }
+    }
+    return r;
+  }
+};
+
+// rotation by angle degrees followed by a translation, p' = R*p + t. the
+// rotation matrix is cached and only rebuilt, with its sin and cos, when
+// the angle changes
+class transform2d {
+  private:
+    float cachedangle;
+    mat2 cachedrotation;
+    
+  public:
+    vec2 translation;
+    
+    transform2d(float angle = 0, const vec2& translation = vec2(0, 0))
+    : cachedangle(angle), cachedrotation(mat2::rotation(angle)), translation(translation)
+    {
+    }
+    
+    // rotation by angle around pivot, which stays in place
+    static transform2d around(const vec2& pivot, float angle) {
+      transform2d t(angle);
+      t.translation = pivot - t.cachedrotation*pivot;
+      return t;
+    }
+    
+    float angle() const {
+      return cachedangle;
+    }
+    void setangle(float angle) {
+      if (angle == cachedangle)
+        return;
+      cachedangle = angle;
+      cachedrotation = mat2::rotation(angle);
+    }
+    
+    const mat2& rotation() const {
+      return cachedrotation;
+    }
+    
+    vec2 point(const vec2& p) const {
+      return cachedrotation*p + translation;
+    }
+    vec2 vector(const vec2& v) const {
+      return cachedrotation*v;
+    }
+    
+    // the inverse transform, p = R^T*(p' - t), as rotations are orthogonal
+    vec2 inversepoint(const vec2& p) const {
+      return cachedrotation.transposed()*(p - translation);
+    }
+    
+    mat3 matrix() const {
+      return mat3(cachedrotation, translation);
+    }
+};
+
+// batches over arrays, written as plain loops without branches nor calls
+// so compilers vectorize them. out may be the same array as in
+
+// transforms n points
+inline void transformpoints(const transform2d& t, const vec2* in, vec2* out, int n) {
+  const mat2& r = t.rotation();
+  float tx = t.translation.x, ty = t.translation.y;
+  for (int i = 0; i < n; i++) {
+    float x = in[i].x, y = in[i].y;
+    out[i].x = r.a*x + r.b*y + tx;
+    out[i].y = r.c*x + r.d*y + ty;
+  }
+}
+
+// rotates n vectors, as normals or speeds
+inline void transformvectors(const transform2d& t, const vec2* in, vec2* out, int n) {
+  const mat2& r = t.rotation();
+  for (int i = 0; i < n; i++) {
+    float x = in[i].x, y = in[i].y;
+    out[i].x = r.a*x + r.b*y;
+    out[i].y = r.c*x + r.d*y;
+  }
+}
+
+// solves the n systems m[i]*x[i] = r[i] by cramer's rule. the solutions of
+// singular systems are zero. returns how many systems were solved
+inline int solve2(const mat2* m, const vec2* r, vec2* x, int n) {
+  int solved = 0;
+  for (int i = 0; i < n; i++) {
+    float det = m[i].a*m[i].d - m[i].b*m[i].c;
+    
+    // divides by one instead of zero, so the division can't trap and the
+    // loop vectorizes
+    float nonzero = (det != 0);
+    float inv = nonzero/(det + (1 - nonzero));
+    float rx = r[i].x, ry = r[i].y;
+    x[i].x = (m[i].d*rx - m[i].b*ry)*inv;
+    x[i].y = (m[i].a*ry - m[i].c*rx)*inv;
+    solved += (det != 0);
+  }
+  return solved;
+}
+
 float det2(const vector3& a, const vector3& b) {
   return a.x()*b.y() - a.y()*b.x();
 }
@@ -0,0 +1,133 @@
+#ifndef PAIRTABLE_H
+#define PAIRTABLE_H
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <stdint.h>
+
+// hash table of pairs keyed by the ids of their two members. the values are
+// kept packed in a dense array, so walking every pair is a linear scan, and
+// an open addressing index with linear probing maps the keys to their place
+// in the array. erasing moves the last value to the hole and shifts back
+// the probe run, so no tombstones are left. every operation is O(1).
+template<typename T>
+class pairtable {
+  public:
+    // canonical key of a pair, the lower id first
+    static uint64_t key(unsigned int a, unsigned int b) {
+      if (a > b)
+        std::swap(a, b);
+      return ((uint64_t)a << 32) | b;
+    }
+    
+  private:
+    struct slot {
+      uint64_t key;
+      int index;
+    };
+    
+    // index slots, a power of two of them and at most half full
+    std::vector<slot> slots;
+    size_t mask;
+    
+    // values in the dense array, with their keys
+    std::vector<T*> values;
+    std::vector<uint64_t> keys;
+    
+  public:
+    pairtable()
+    : slots(16), mask(15)
+    {
+      for (size_t i = 0; i < slots.size(); i++)
+        slots[i].index = -1;
+    }
+    
+    size_t size() const {
+      return values.size();
+    }
+    
+    // value at a place of the dense array
+    T* operator[](size_t i) const {
+      return values[i];
+    }
+    
+    // value of a key, or 0 if the key is not in the table
+    T* find(uint64_t k) const {
+      for (size_t s = home(k); slots[s].index >= 0; s = (s + 1) & mask) {
+        if (slots[s].key == k)
+          return values[slots[s].index];
+      }
+      return 0;
+    }
+    
+    // adds a value under a key not in the table yet
+    void insert(uint64_t k, T* value) {
+      if (2*(values.size() + 1) > slots.size())
+        rehash(2*slots.size());
+      
+      size_t s = home(k);
+      while (slots[s].index >= 0)
+        s = (s + 1) & mask;
+      slots[s].key = k;
+      slots[s].index = values.size();
+      values.push_back(value);
+      keys.push_back(k);
+    }
+    
+    // removes a key and its value. the last value of the dense array takes
+    // its place
+    void erase(uint64_t k) {
+      size_t s = locate(k);
+      int index = slots[s].index;
+      int last = values.size() - 1;
+      if (index != last) {
+        values[index] = values[last];
+        keys[index] = keys[last];
+        slots[locate(keys[index])].index = index;
+      }
+      values.pop_back();
+      keys.pop_back();
+      
+      // shifts back the entries of the run that probed past the hole
+      size_t hole = s;
+      for (size_t next = (s + 1) & mask; slots[next].index >= 0; next = (next + 1) & mask) {
+        size_t h = home(slots[next].key);
+        if (((next - h) & mask) >= ((next - hole) & mask)) {
+          slots[hole] = slots[next];
+          hole = next;
+        }
+      }
+      slots[hole].index = -1;
+    }
+    
+  private:
+    size_t home(uint64_t k) const {
+      // fibonacci hashing, the high bits are the best mixed
+      return (size_t)((k*0x9e3779b97f4a7c15ull) >> 32) & mask;
+    }
+    
+    // index slot holding a key known to be in the table
+    size_t locate(uint64_t k) const {
+      size_t s = home(k);
+      while (slots[s].key != k || slots[s].index < 0)
+        s = (s + 1) & mask;
+      return s;
+    }
+    
+    void rehash(size_t count) {
+      slots.assign(count, slot());
+      mask = count - 1;
+      for (size_t i = 0; i < slots.size(); i++)
+        slots[i].index = -1;
+      for (size_t i = 0; i < keys.size(); i++) {
+        size_t s = home(keys[i]);
+        while (slots[s].index >= 0)
+          s = (s + 1) & mask;
+        slots[s].key = keys[i];
+        slots[s].index = i;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// fixed size slot allocator. memory is taken in blocks of many slots and
+// freed slots go to a free list threaded through the slots themselves, so
+// once the pool has grown to the largest population it allocates nothing,
+// and the objects it holds stay packed together in memory. blocks are only
+// given back when the pool is destroyed.
+class slotpool {
+  private:
+    size_t slotsize;
+    size_t perblock;
+    std::vector<char*> blocks;
+    void* freelist;
+    
+  public:
+    slotpool(size_t size, size_t perblock = 64)
+    : perblock(perblock), freelist(0)
+    {
+      // slots hold the free list link and keep the strictest alignment
+      const size_t align = alignof(std::max_align_t);
+      slotsize = (std::max(size, sizeof(void*)) + align - 1)/align*align;
+    }
+    
+    ~slotpool() {
+      for (size_t i = 0; i < blocks.size(); i++)
+        ::operator delete(blocks[i]);
+    }
+    
+    void* allocate() {
+      if (!freelist)
+        grow();
+      void* slot = freelist;
+      freelist = *(void**)slot;
+      return slot;
+    }
+    
+    void release(void* slot) {
+      *(void**)slot = freelist;
+      freelist = slot;
+    }
+    
+  private:
+    slotpool(const slotpool&);
+    slotpool& operator=(const slotpool&);
+    
+    void grow() {
+      char* block = (char*)::operator new(slotsize*perblock);
+      blocks.push_back(block);
+      for (size_t i = perblock; i > 0; i--)
+        release(block + (i - 1)*slotsize);
+    }
+};
+
+// pool of objects of type T over a slotpool
+template<typename T>
+class pool {
+  private:
+    slotpool slots;
+    
+  public:
+    pool()
+    : slots(sizeof(T))
+    {
+    }
+    
+    template<typename... A>
+    T* create(A&&... args) {
+      return new (slots.allocate()) T(std::forward<A>(args)...);
+    }
+    
+    void destroy(T* object) {
+      object->~T();
+      slots.release(object);
+    }
+};
+
+// slot pools shared by the objects of many sizes, one for every size
+// rounded up to 16 bytes. meant for class specific operator new and delete
+// of class hierarchies, whose derived classes differ in size. the pools are
+// never destroyed, as objects may be deleted during static destruction
+inline slotpool& sizedpool(size_t size) {
+  static std::vector<slotpool*>* pools = new std::vector<slotpool*>();
+  size_t index = (size + 15)/16;
+  if (index >= pools->size())
+    pools->resize(index + 1, 0);
+  if (!(*pools)[index])
+    (*pools)[index] = new slotpool(index*16);
+  return *(*pools)[index];
+}
+
+#endif
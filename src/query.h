@@ -0,0 +1,74 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <vector>
+#include "gear2d.h"
+#include "linearalgebra.h"
+
+using namespace gear2d;
+
+class shape;
+
+// segment cast against the collision world, from its start to its end
+struct ray {
+  vec2 from, to;
+  
+  ray(const vec2& from = vec2(0, 0), const vec2& to = vec2(0, 0))
+  : from(from), to(to)
+  {
+  }
+};
+
+// shape found by a query. ray casts also fill where the shape was hit: the
+// fraction t of the segment, the point and the outward normal there. rays
+// starting inside a shape hit it at t zero with a null normal
+struct queryhit {
+  component::base* collider;
+  const shape* sh;
+  
+  float t;
+  vec2 point;
+  vec2 normal;
+};
+
+typedef std::vector<queryhit> hitlist;
+
+// spatial queries against the shapes of every collider, served by the same
+// broadphase structures as the collision checks. every collider writes a
+// pointer to the world to its collider.world parameter, so other components
+// can fetch it for line of sight, picking or area effects.
+//
+// the broadphase sees the shapes as of the last collider update, and the
+// shapes it reports are tested at their current positions. single queries
+// append to the lists given and batches refill them, so neither allocates
+// once the lists have grown. only shapes of the layers set in mask are
+// reported.
+class collisionworld {
+  public:
+    virtual ~collisionworld() { }
+    
+    // shapes containing the point
+    virtual void overlappoint(const vec2& point, hitlist& hits, unsigned int mask = ~0u) = 0;
+    
+    // shapes overlapping the box from min to max
+    virtual void overlapbox(const vec2& min, const vec2& max, hitlist& hits, unsigned int mask = ~0u) = 0;
+    
+    // shapes overlapping the circle
+    virtual void overlapcircle(const vec2& center, float radius, hitlist& hits, unsigned int mask = ~0u) = 0;
+    
+    // closest shape along the ray. returns false if nothing was hit
+    virtual bool raycast(const ray& r, queryhit& hit, unsigned int mask = ~0u) = 0;
+    
+    // every shape along the ray, closest first
+    virtual void raycastall(const ray& r, hitlist& hits, unsigned int mask = ~0u) = 0;
+    
+    // batches of rays, sharing the traversals of the broadphase. hits[i] is
+    // the closest hit of rays[i], with a null shape when nothing was hit
+    virtual void raycast(const ray* rays, int count, hitlist& hits, unsigned int mask = ~0u) = 0;
+    
+    // the hits of rays[i], closest first, go from hits[offsets[i]] up to
+    // hits[offsets[i + 1]]
+    virtual void raycastall(const ray* rays, int count, hitlist& hits, std::vector<int>& offsets, unsigned int mask = ~0u) = 0;
+};
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <stdint.h>
+#include "shapes.h"
+
+// binary recording of the collider input, one frame after the other, so a
+// slow frame seen in a game can be replayed and profiled without it. every
+// field is 4 bytes wide and every array is of fixed size records, so the
+// file can be mapped in memory and walked in place. values are stored in
+// the byte order of the machine that recorded them.
+//
+//   file header, then settings bytes of "name=value\n" scene parameters,
+//     padded with newlines to a multiple of 4 bytes
+//   per frame:
+//     frame header
+//     objects records
+//     shapes records, each pointing to its object by index
+//     points vertices, the outlines of the polygons
+namespace recording {
+  const uint32_t magic = 0x52433247;       // "G2CR"
+  const uint32_t framemagic = 0x4d415246;  // "FRAM"
+  const uint32_t version = 1;
+  
+  struct fileheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t settings;
+  };
+  
+  struct frameheader {
+    uint32_t magic;
+    
+    // size of the whole frame, header included
+    uint32_t bytes;
+    
+    int32_t frame;
+    float dt;
+    uint32_t objects;
+    uint32_t shapes;
+    uint32_t points;
+  };
+  
+  // kinematic snapshot of an object, as the collider took it
+  struct objectrecord {
+    uint32_t id;
+    uint32_t fixed;
+    float mass;
+    float x, y;
+    float xspeed, yspeed;
+    float xaccel, yaccel;
+  };
+  
+  // shape of an object, at x and y relative to it. width and height hold
+  // the size of the rectangles and the obbs, both the radius of the
+  // circles and the tile size of the tilemaps. polygons list points
+  // vertices of their outline from firstpoint. tilemaps list the columns
+  // and rows of their grid as the first point, then the first cell and the
+  // size in cells of every merged block as two points
+  struct shaperecord {
+    uint32_t object;
+    uint32_t type;
+    uint32_t fixed;
+    uint32_t layer, mask;
+    float x, y;
+    float width, height;
+    float theta;
+    uint32_t firstpoint;
+    uint32_t points;
+  };
+  
+  struct point {
+    float x, y;
+  };
+}
+
+// appends the frames to a recording. a frame is gathered in memory and
+// written at once by end()
+class framerecorder {
+  private:
+    std::ofstream file;
+    recording::frameheader header;
+    std::vector<recording::objectrecord> objects;
+    std::vector<recording::shaperecord> shapes;
+    std::vector<recording::point> points;
+    
+  public:
+    bool active() const {
+      return file.is_open();
+    }
+    
+    // starts a recording at path with the scene parameters given. returns
+    // false if the file can't be created
+    bool open(const std::string& path, std::string settings) {
+      file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file)
+        return false;
+      while (settings.size() % 4)
+        settings += '\n';
+      recording::fileheader h = { recording::magic, recording::version, (uint32_t)settings.size() };
+      file.write((const char*)&h, sizeof(h));
+      file.write(settings.data(), settings.size());
+      return true;
+    }
+    
+    void begin(int frame, timediff dt) {
+      header.magic = recording::framemagic;
+      header.frame = frame;
+      header.dt = dt;
+      objects.clear();
+      shapes.clear();
+      points.clear();
+    }
+    
+    // adds an object. returns its index, which its shapes refer to
+    int object(unsigned int id, bool fixed, float mass, const body& b) {
+      recording::objectrecord o = { id, fixed, mass, b.x, b.y, b.xspeed, b.yspeed, b.xaccel, b.yaccel };
+      objects.push_back(o);
+      return objects.size() - 1;
+    }
+    
+    void add(int object, const shape* sh) {
+      recording::shaperecord s;
+      std::memset(&s, 0, sizeof(s));
+      s.object = object;
+      s.type = sh->type;
+      s.fixed = sh->fixed;
+      s.layer = sh->layer;
+      s.mask = sh->mask;
+      vec2 offset = sh->getoffset();
+      s.x = offset.x;
+      s.y = offset.y;
+      s.firstpoint = points.size();
+      
+      if (sh->type == typeindex<rectangle, shapetypes>::value) {
+        const rectangle* r = static_cast<const rectangle*>(sh);
+        s.width = r->width();
+        s.height = r->height();
+      } else if (sh->type == typeindex<circle, shapetypes>::value) {
+        s.width = s.height = static_cast<const circle*>(sh)->radius();
+      } else if (sh->type == typeindex<obb, shapetypes>::value) {
+        const obb* o = static_cast<const obb*>(sh);
+        s.width = o->width();
+        s.height = o->height();
+        s.theta = o->angle();
+      } else if (sh->type == typeindex<tilemap, shapetypes>::value) {
+        const tilemap* t = static_cast<const tilemap*>(sh);
+        s.width = t->tilesize().x;
+        s.height = t->tilesize().y;
+        recording::point grid = { (float)t->columncount(), (float)t->rowcount() };
+        points.push_back(grid);
+        const vector<tilemap::block>& blocks = t->getblocks();
+        for (size_t i = 0; i < blocks.size(); i++) {
+          recording::point cell = { (float)blocks[i].column, (float)blocks[i].row };
+          recording::point size = { (float)blocks[i].columns, (float)blocks[i].rows };
+          points.push_back(cell);
+          points.push_back(size);
+        }
+        s.points = 1 + 2*blocks.size();
+      } else {
+        const convex* c = static_cast<const convex*>(sh);
+        s.theta = c->angle();
+        const vector<vec2>& outline = c->getoutline();
+        for (size_t i = 0; i < outline.size(); i++) {
+          recording::point p = { outline[i].x, outline[i].y };
+          points.push_back(p);
+        }
+        s.points = outline.size();
+      }
+      shapes.push_back(s);
+    }
+    
+    void end() {
+      header.objects = objects.size();
+      header.shapes = shapes.size();
+      header.points = points.size();
+      header.bytes = sizeof(header) + objects.size()*sizeof(recording::objectrecord) +
+        shapes.size()*sizeof(recording::shaperecord) + points.size()*sizeof(recording::point);
+      file.write((const char*)&header, sizeof(header));
+      if (objects.size())
+        file.write((const char*)&objects[0], objects.size()*sizeof(recording::objectrecord));
+      if (shapes.size())
+        file.write((const char*)&shapes[0], shapes.size()*sizeof(recording::shaperecord));
+      if (points.size())
+        file.write((const char*)&points[0], points.size()*sizeof(recording::point));
+      file.flush();
+    }
+};
+
+// frames of a recording read back, pointing straight into the file bytes
+class framereader {
+  public:
+    struct frame {
+      const recording::frameheader* header;
+      const recording::objectrecord* objects;
+      const recording::shaperecord* shapes;
+      const recording::point* points;
+    };
+    
+  private:
+    std::vector<char> bytes;
+    std::string scene;
+    std::vector<frame> frames;
+    
+  public:
+    // loads a recording. returns false if the file can't be read or is not
+    // a recording of this version. a frame cut short by the end of the
+    // file, as when the game was killed while recording, is left out, and
+    // so is everything from a frame whose size doesn't match its counts or
+    // whose shapes point outside of it
+    bool open(const std::string& path) {
+      std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+      if (!file)
+        return false;
+      bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+      frames.clear();
+      
+      // the records hold nothing wider than 4 bytes, and a vector buffer is
+      // aligned for any of them
+      if (bytes.size() < sizeof(recording::fileheader))
+        return false;
+      const recording::fileheader* h = (const recording::fileheader*)&bytes[0];
+      if (h->magic != recording::magic || h->version != recording::version)
+        return false;
+      size_t at = sizeof(recording::fileheader) + h->settings;
+      if (at > bytes.size())
+        return false;
+      scene.assign(&bytes[sizeof(recording::fileheader)], h->settings);
+      
+      while (at + sizeof(recording::frameheader) <= bytes.size()) {
+        frame f;
+        f.header = (const recording::frameheader*)&bytes[at];
+        if (f.header->magic != recording::framemagic || f.header->bytes != framesize(*f.header))
+          break;
+        if (at + f.header->bytes > bytes.size())
+          break;
+        f.objects = (const recording::objectrecord*)(f.header + 1);
+        f.shapes = (const recording::shaperecord*)(f.objects + f.header->objects);
+        f.points = (const recording::point*)(f.shapes + f.header->shapes);
+        if (!valid(f))
+          break;
+        frames.push_back(f);
+        at += f.header->bytes;
+      }
+      return true;
+    }
+    
+    // scene parameters the recording was made with, "name=value\n" each
+    const std::string& settings() const {
+      return scene;
+    }
+    
+    size_t size() const {
+      return frames.size();
+    }
+    
+    const frame& operator[](size_t i) const {
+      return frames[i];
+    }
+    
+  private:
+    // bytes a frame takes with the counts of its header, in 64 bits so
+    // corrupt counts can't wrap around to a plausible size
+    static uint64_t framesize(const recording::frameheader& h) {
+      return sizeof(recording::frameheader) +
+        (uint64_t)h.objects*sizeof(recording::objectrecord) +
+        (uint64_t)h.shapes*sizeof(recording::shaperecord) +
+        (uint64_t)h.points*sizeof(recording::point);
+    }
+    
+    // whether every shape is of a known type, belongs to an object of the
+    // frame and lists points inside of it
+    static bool valid(const frame& f) {
+      for (uint32_t s = 0; s < f.header->shapes; s++) {
+        const recording::shaperecord& sh = f.shapes[s];
+        if (sh.type >= shapetypes::size || sh.object >= f.header->objects)
+          return false;
+        if ((uint64_t)sh.firstpoint + sh.points > f.header->points)
+          return false;
+      }
+      return true;
+    }
+};
+
+#endif
@@ -2,43 +2,239 @@
 #ifndef SHAPES_H
 #define SHAPES_H
 
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <sstream>
+#include <fstream>
 #include "gear2d.h"
 #include "linearalgebra.h"
+#include "toi.h"
+#include "collision.h"
+#include "pool.h"
 
 using namespace std;
 using namespace gear2d;
 
-// every new shape class implementation must add lines in the
-// marked points of this file.
-
-// CLASS LISTING MARK
+// every new shape class must be added to the shapetypes list below and its
+// name to shapenames, derive from shape passing its index in that list,
+// grant friendship to narrowphase and implement one narrowphase::collides
+// overload for each shape type that comes before it in the list, plus
+// itself. the dispatch table of all pairs and the constructor table used to
+// load the shapes are generated from the list.
+class shape;
 class rectangle;
 class circle;
+class obb;
+class polygon;
+class tilemap;
+
+// list of shape types, the position of a type is its identifier
+template<typename... T>
+struct shapelist {
+  static constexpr int size = sizeof...(T);
+};
+
+typedef shapelist<rectangle, circle, obb, polygon, tilemap> shapetypes;
+
+// names of the shape types, as in the type parameter of the shapes, in the
+// order of shapetypes
+const char* const shapenames[shapetypes::size] = { "rectangle", "circle", "obb", "polygon", "tilemap" };
+
+// position of type T in the list
+template<typename T, typename list>
+struct typeindex;
+
+template<typename T, typename... rest>
+struct typeindex<T, shapelist<T, rest...> > {
+  static constexpr int value = 0;
+};
+
+template<typename T, typename U, typename... rest>
+struct typeindex<T, shapelist<U, rest...> > {
+  static constexpr int value = 1 + typeindex<T, shapelist<rest...> >::value;
+};
+
+// axis aligned bounding box, used by the broadphase to cull shape pairs
+struct aabb {
+  float xmin, ymin, xmax, ymax;
+  
+  aabb(float xmin = 0, float ymin = 0, float xmax = 0, float ymax = 0)
+  : xmin(xmin), ymin(ymin), xmax(xmax), ymax(ymax)
+  {
+  }
+  
+  // touching boxes overlap, as touching shapes collide in the narrowphase
+  bool overlaps(const aabb& other) const {
+    return (
+      xmin <= other.xmax && other.xmin <= xmax &&
+      ymin <= other.ymax && other.ymin <= ymax
+    );
+  }
+  
+  bool contains(const aabb& other) const {
+    return (
+      xmin <= other.xmin && other.xmax <= xmax &&
+      ymin <= other.ymin && other.ymax <= ymax
+    );
+  }
+  
+  float perimeter() const {
+    return 2*((xmax - xmin) + (ymax - ymin));
+  }
+  
+  bool operator==(const aabb& other) const {
+    return (
+      xmin == other.xmin && ymin == other.ymin &&
+      xmax == other.xmax && ymax == other.ymax
+    );
+  }
+  
+  // grows this box to contain other
+  void merge(const aabb& other) {
+    if (other.xmin < xmin) xmin = other.xmin;
+    if (other.ymin < ymin) ymin = other.ymin;
+    if (other.xmax > xmax) xmax = other.xmax;
+    if (other.ymax > ymax) ymax = other.ymax;
+  }
+  
+  // smallest box containing a and b
+  static aabb combine(const aabb& a, const aabb& b) {
+    aabb box = a;
+    box.merge(b);
+    return box;
+  }
+  
+  // first point where the segment from + (to - from)*t, t in [0, 1], meets
+  // the box, by clipping the segment against the slabs of both axes. normal
+  // receives the side hit, or zero when the segment starts inside
+  bool raycast(const vec2& from, const vec2& to, float& t, vec2& normal) const {
+    float start[2] = { from.x, from.y };
+    float delta[2] = { to.x - from.x, to.y - from.y };
+    float lo[2] = { xmin, ymin };
+    float hi[2] = { xmax, ymax };
+    
+    float enter = 0, exit = 1;
+    normal = vec2(0, 0);
+    for (int axis = 0; axis < 2; axis++) {
+      if (delta[axis] == 0) {
+        if (start[axis] < lo[axis] || start[axis] > hi[axis])
+          return false;
+        continue;
+      }
+      
+      float near = (lo[axis] - start[axis])/delta[axis];
+      float far = (hi[axis] - start[axis])/delta[axis];
+      float side = -1;
+      if (near > far) {
+        std::swap(near, far);
+        side = 1;
+      }
+      if (near > enter) {
+        enter = near;
+        normal = (axis == 0) ? vec2(side, 0) : vec2(0, side);
+      }
+      exit = std::min(exit, far);
+      if (enter > exit)
+        return false;
+    }
+    
+    t = enter;
+    return true;
+  }
+};
+
+// kinematic state of a collider object. the collider takes one snapshot
+// per object and frame, and the pair tests read only from it
+struct body {
+  // object position
+  float x, y;
+  
+  float xspeed, yspeed;
+  float xaccel, yaccel;
+  
+  // function to add next object position to position relative to object
+  vec2 getpos(float xrel, float yrel, timediff dt) const {
+    return vec2(
+      xrel + x + xspeed*dt + xaccel*dt*dt*0.5,
+      yrel + y + yspeed*dt + yaccel*dt*dt*0.5
+    );
+  }
+  
+  bool operator==(const body& other) const {
+    return (
+      x == other.x && y == other.y &&
+      xspeed == other.xspeed && yspeed == other.yspeed &&
+      xaccel == other.xaccel && yaccel == other.yaccel
+    );
+  }
+};
+
+// pair of shapes tracked by the collider. both shapes list the pairs they
+// take part in, so removing a shape only visits its own pairs
+struct pairrecord {
+  shape* shape1;
+  shape* shape2;
+  
+  // positions of the record in the pair lists of both shapes
+  int slot1, slot2;
+  
+  pairrecord(shape* shape1, shape* shape2)
+  : shape1(shape1), shape2(shape2), slot1(-1), slot2(-1)
+  {
+  }
+};
 
 // shape base class
 class shape {
-  private:
-    typedef bool (shape::*checkcallback)(shape*, const vector3&, const vector3&);
-    
   protected:
     component::base* owner;
     string name;
     
-    // object position
-    gear2d::link<float> x0, y0;
-    
     // shape position. relativity varies depending on geometric shape
     gear2d::link<float> x, y;
     
-    // temporary storage for checkcollision function
-    float xaccel, yaccel, xspeed, yspeed;
+  public:
+    // unique shape identifier, also used to order shape pairs
+    const unsigned int id;
+    
+    // shape type identifier, the index of the type in shapetypes
+    const int type;
+    
+    // handle of this shape inside the broadphase it is registered in
+    int proxy;
+    
+    // index of the owner object snapshot in the body array of the frame
+    int bodyid;
+    
+    // swept bounds of the shape over the frame
+    aabb box;
+    
+    // bumped every time prepare() changes the geometry, so results cached
+    // from the old geometry are told apart even when the bounds stay
+    unsigned int revision;
+    
+    // static shapes never move on their own and are never tested against
+    // each other. resting shapes, static or asleep, are kept apart from the
+    // broadphase and only tested against awake shapes
+    bool fixed;
+    bool resting;
+    
+    // collision filter. the shape belongs to the layers set in layer and
+    // collides only with shapes in the layers set in mask. defaults to
+    // layer 1 colliding with every layer
+    unsigned int layer;
+    unsigned int mask;
+    
+    // pairs the shape takes part in
+    vector<pairrecord*> pairs;
     
   public:
-    shape(component::base* owner, object::signature & sig, const string& name)
-    : owner(owner), name("collider." + name + ".") {
-      // init x0, y0
-      x0 = owner->fetch<float>("x");
-      y0 = owner->fetch<float>("y");
+    shape(int type, component::base* owner, object::signature & sig, const string& name)
+    : owner(owner), name("collider." + name + "."), id(newid()), type(type), proxy(-1), bodyid(-1), revision(0), fixed(false), resting(false) {
+      // init the filter. accepts decimal, hexadecimal (0x) and octal (0)
+      layer = bits(sig[this->name + "layer"], 1);
+      mask = bits(sig[this->name + "mask"], ~0u);
       
       // init x
       owner->write(this->name + "x", eval<float>(sig[this->name + "x"]));
@@ -49,50 +245,135 @@ class shape {
       y = owner->fetch<float>(this->name + "y");
     }
     
+    virtual ~shape() { }
+    
+    // shapes are allocated from pools, one per shape size
+    static void* operator new(size_t size) {
+      return sizedpool(size).allocate();
+    }
+    static void operator delete(void* p, size_t size) {
+      sizedpool(size).release(p);
+    }
+    
   private:
-    // function to add next object position to shape position
-    vector3 getpos(timediff dt) const {
-      return vector3(
-        x + x0 + xspeed*dt + xaccel*dt*dt*0.5,
-        y + y0 + yspeed*dt + yaccel*dt*dt*0.5
-      );
+    static unsigned int newid() {
+      static unsigned int next = 0;
+      return next++;
+    }
+    
+    static unsigned int bits(const string& value, unsigned int fallback) {
+      if (value.empty())
+        return fallback;
+      return strtoul(value.c_str(), 0, 0);
     }
     
   public:
-    // uses interpolation to check collision over interpolation steps.
-    // calls the collision detection function according to the type of shape.
-    bool checkcollision(timediff dt, shape* other) {
-      int interpolation_steps = 1;  //TODO change for scene const parameter
-      timediff step = dt/interpolation_steps;
-      string other_type = other->type();
-      checkcallback ccb;
-      
-      // FUNCTION ROUTING MARK
-      if (other_type == "rectangle")
-        ccb = (checkcallback)&shape::collidesrectangle;
-      else if (other_type == "circle")
-        ccb = (checkcallback)&shape::collidescircle;
+    // shape position after dt, following the owner object motion
+    vec2 getpos(const body& b, timediff dt) const {
+      return b.getpos(x, y, dt);
+    }
+    
+    component::base* getowner() const {
+      return owner;
+    }
+    
+    // position of the shape relative to its object
+    vec2 getoffset() const {
+      return vec2(x, y);
+    }
+    
+    // adds a pair to the pair list of the shape
+    void attach(pairrecord* p) {
+      (p->shape1 == this ? p->slot1 : p->slot2) = pairs.size();
+      pairs.push_back(p);
+    }
+    
+    // removes a pair from the pair list, moving the last pair to its slot
+    void detach(pairrecord* p) {
+      int slot = (p->shape1 == this ? p->slot1 : p->slot2);
+      pairrecord* last = pairs.back();
+      pairs[slot] = last;
+      (last->shape1 == this ? last->slot1 : last->slot2) = slot;
+      pairs.pop_back();
+    }
+    
+    // parameter prefix of the shape, as in collider.name.
+    const string& getname() const {
+      return name;
+    }
+    
+    // whether the pair may collide at all: shapes of different objects
+    // whose filters accept each other. runs before any geometry
+    bool interacts(const shape* other) const {
+      return owner != other->owner && (layer & other->mask) && (other->layer & mask);
+    }
+    
+    // bounding box of the shape over its whole motion in [0, dt], so the
+    // broadphase never culls a pair that the interpolation steps would hit
+    aabb sweptbounds(const body& b, timediff dt) const {
+      aabb box = bounds(getpos(b, 0));
+      box.merge(bounds(getpos(b, dt)));
       
-      // iterates over all steps to check collision
-      owner->read<float>("x.accel", xaccel); owner->read<float>("y.accel", yaccel);
-      owner->read<float>("x.speed", xspeed); owner->read<float>("y.speed", yspeed);
-      for (timediff local_dt = 0; local_dt <= dt; local_dt += step) {
-        if ((this->*ccb)(other, getpos(local_dt), other->getpos(local_dt)))
-          return true;
-      }
+      // the motion is quadratic, so it may turn around inside the interval
+      if (b.xaccel && -b.xspeed/b.xaccel > 0 && -b.xspeed/b.xaccel < dt)
+        box.merge(bounds(getpos(b, -b.xspeed/b.xaccel)));
+      if (b.yaccel && -b.yspeed/b.yaccel > 0 && -b.yspeed/b.yaccel < dt)
+        box.merge(bounds(getpos(b, -b.yspeed/b.yaccel)));
       
+      return box;
+    }
+    
+    // predicted motion of the shape over dt
+    vec2 displacement(const body& b, timediff dt) const {
+      return getpos(b, dt) - getpos(b, 0);
+    }
+    
+    // number of interpolation steps the pair needs so that no step moves
+    // the shapes, relative to each other, more than the smallest of them.
+    // slow pairs get a single step and no pair gets more than maxsteps.
+    int substeps(timediff dt, const body& self, const shape* other, const body& otherbody, int maxsteps) const;
+    
+    // uses interpolation to check collision over interpolation steps.
+    // calls the collision detection function of the pair of shape types.
+    // the motion of both shapes comes from the frame snapshots, so the check
+    // touches no parameter and changes no state.
+    // on collision, toi receives the first step time where the shapes touch.
+    bool checkcollision(timediff dt, const body& self, const shape* other, const body& otherbody, int steps, timediff& toi) const;
+    
+    // continuous collision check. solves the time of impact of the pair
+    // along the whole motion, so fast shapes don't tunnel through others.
+    // pairs without an analytic solver fall back to steps interpolations.
+    bool timeofimpact(timediff dt, const body& self, const shape* other, const body& otherbody, int steps, timediff& toi) const;
+    
+    // contact of the shape at pos with other at otherpos. on overlap gives
+    // the unit normal pointing from this shape to other and the depth other
+    // must move along it to stop overlapping
+    bool contact(const vec2& pos, const shape* other, const vec2& otherpos, vec2& normal, float& depth) const;
+    
+    // refreshes the geometry the shape caches between frames. called by the
+    // collider on the update thread, before any test of the frame. returns
+    // true if the geometry changed
+    virtual bool prepare() {
       return false;
     }
     
+    // tests of the spatial queries, with the shape at pos. touching counts
+    // as overlapping
+    virtual bool overlaps(const vec2& pos, const aabb& box) const = 0;
+    virtual bool overlaps(const vec2& pos, const vec2& center, float radius) const = 0;
+    
+    // first point where the segment from + (to - from)*t, t in [0, 1],
+    // meets the shape border. normal receives the outward normal there, or
+    // zero when the segment starts inside the shape
+    virtual bool raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const = 0;
+    
   private:
-    // ABSTRACT FUNCTIONS MARK
-    virtual string type() const = 0;
-    virtual bool collidesrectangle(rectangle*, const vector3&, const vector3&) = 0;
-    virtual bool collidescircle(circle*, const vector3&, const vector3&) = 0;
+    virtual aabb bounds(const vec2& pos) const = 0;
+    
+    // smallest dimension of the shape
+    virtual float extent() const = 0;
 };
 
-// CLASS DECLARATION MARK
-
 class rectangle : public shape {
   private:
     // in this class, x and y are the position of the left upper corner of
@@ -102,17 +383,24 @@ class rectangle : public shape {
     gear2d::link<float> w, h;
     
   public:
-    // FRIENDSHIP MARK
-    friend class circle;
+    friend struct narrowphase;
     
     rectangle(component::base* owner, object::signature & sig, const string& name);
     
-  private:
-    string type() const;
+    float width() const {
+      return w;
+    }
+    float height() const {
+      return h;
+    }
     
-    // ABSTRACT FUNCTIONS MARK
-    bool collidesrectangle(rectangle* other, const vector3& this_pos, const vector3& other_pos);
-    bool collidescircle(circle* other, const vector3& this_pos, const vector3& other_pos);
+    bool overlaps(const vec2& pos, const aabb& box) const;
+    bool overlaps(const vec2& pos, const vec2& center, float radius) const;
+    bool raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const;
+    
+  private:
+    aabb bounds(const vec2& pos) const;
+    float extent() const;
 };
 
 class circle : public shape {
@@ -123,28 +411,415 @@ class circle : public shape {
     gear2d::link<float> r;
     
   public:
-    // FRIENDSHIP MARK
-    friend class rectangle;
+    friend struct narrowphase;
     
     circle(component::base* owner, object::signature & sig, const string& name);
     
+    float radius() const {
+      return r;
+    }
+    
+    bool overlaps(const vec2& pos, const aabb& box) const;
+    bool overlaps(const vec2& pos, const vec2& center, float radius) const;
+    bool raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const;
+    
+  private:
+    aabb bounds(const vec2& pos) const;
+    float extent() const;
+};
+
+// base of the convex polygon shapes, tested with the separating axis
+// theorem. the outline is given relative to the shape position and rotated
+// by theta degrees around pivot. the rotated vertices, their edge normals
+// and their bounding box are cached, and prepare() only rebuilds them when
+// the angle or the outline changes. the tests then only offset the cached
+// geometry by the shape position, which needs no sin nor cos.
+class convex : public shape {
+  protected:
+    // rotation in degrees
+    gear2d::link<float> theta;
+    
+    // vertices relative to the shape position at theta zero, in
+    // counterclockwise order, and the point they rotate around
+    vector<vec2> outline;
+    vec2 pivot;
+    
+    // set when the outline changes
+    bool reshaped;
+    
+  private:
+    // cached geometry, relative to the shape position
+    float cachedtheta;
+    vector<vec2> vertices;
+    vector<vec2> normals;
+    aabb hull;
+    
+  public:
+    friend struct narrowphase;
+    
+    convex(int type, component::base* owner, object::signature & sig, const string& name);
+    
+    float angle() const {
+      return theta;
+    }
+    
+    // vertices at theta zero, counterclockwise
+    const vector<vec2>& getoutline() const {
+      return outline;
+    }
+    
+    virtual bool prepare();
+    
+    bool overlaps(const vec2& pos, const aabb& box) const;
+    bool overlaps(const vec2& pos, const vec2& center, float radius) const;
+    bool raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const;
+    
+  protected:
+    // puts the outline in counterclockwise order. throws if it is not a
+    // convex polygon
+    void validate();
+    
+  private:
+    aabb bounds(const vec2& pos) const;
+    float extent() const;
+};
+
+// rotated rectangle. as in rectangle, x and y are the position of the left
+// upper corner when theta is zero, and it rotates around its center
+class obb : public convex {
+  private:
+    // width and height
+    gear2d::link<float> w, h;
+    float cachedw, cachedh;
+    
+  public:
+    obb(component::base* owner, object::signature & sig, const string& name);
+    
+    float width() const {
+      return w;
+    }
+    float height() const {
+      return h;
+    }
+    
+    bool prepare();
+};
+
+// convex polygon. the points parameter lists the coordinates of its
+// vertices, "x0 y0 x1 y1 ...", relative to x and y, around which it
+// rotates
+class polygon : public convex {
+  public:
+    polygon(component::base* owner, object::signature & sig, const string& name);
+};
+
+// static level geometry as a grid of tiles, tilewidth by tileheight each,
+// with the upper left corner of the grid at x and y. the tiles parameter
+// lists the rows of the grid, top to bottom, separated by spaces or line
+// breaks, or the file parameter names a file holding one row per line.
+// cells other than '0', '.' and ' ' are solid.
+//
+// the solid cells are merged into few rectangles by greedy meshing, and
+// every cell keeps the rectangle covering it, so the tests against another
+// shape only visit the rectangles of the cells its bounds cover. the grid
+// is read once, when the shape is created.
+class tilemap : public shape {
   public:
-    static bool linesegcollision(const vector3& v0, const vector3& v, const vector3& center, float radius);
+    // merged rectangle of the grid, in cells
+    struct block {
+      int column, row;
+      int columns, rows;
+    };
     
   private:
-    string type() const;
+    float tilewidth, tileheight;
+    int columns, rows;
+    vector<block> blocks;
     
-    // ABSTRACT FUNCTIONS MARK
-    bool collidesrectangle(rectangle* other, const vector3& this_pos, const vector3& other_pos);
-    bool collidescircle(circle* other, const vector3& this_pos, const vector3& other_pos);
+    // block covering each cell, by rows, or -1 for the empty cells
+    vector<int> cells;
+    
+  public:
+    friend struct narrowphase;
+    
+    tilemap(component::base* owner, object::signature & sig, const string& name);
+    
+    vec2 tilesize() const {
+      return vec2(tilewidth, tileheight);
+    }
+    int columncount() const {
+      return columns;
+    }
+    int rowcount() const {
+      return rows;
+    }
+    const vector<block>& getblocks() const {
+      return blocks;
+    }
+    
+    bool overlaps(const vec2& pos, const aabb& box) const;
+    bool overlaps(const vec2& pos, const vec2& center, float radius) const;
+    bool raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const;
+    
+    // calls test(min, size) with the upper left corner and the size of
+    // every block overlapping or touching area, with the grid at pos, until
+    // it returns true. each block is visited once, from the first of its
+    // cells looked at. returns whether test returned true
+    template<typename F>
+    bool visit(const vec2& pos, const aabb& area, F test) const;
+    
+  private:
+    // merges the solid cells of the rows into blocks
+    void merge(const vector<string>& grid);
+    
+    aabb bounds(const vec2& pos) const;
+    float extent() const;
+};
+
+// collision tests of every pair of shape types. each test receives the
+// shapes in the order they appear in shapetypes.
+struct narrowphase {
+  static bool collides(const rectangle& a, const vec2& a_pos, const rectangle& b, const vec2& b_pos);
+  static bool collides(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos);
+  static bool collides(const circle& a, const vec2& a_pos, const circle& b, const vec2& b_pos);
+  
+  // tests of the convex shapes, with an aabb early out before the
+  // separating axis tests
+  static bool collides(const rectangle& a, const vec2& a_pos, const convex& b, const vec2& b_pos);
+  static bool collides(const circle& a, const vec2& a_pos, const convex& b, const vec2& b_pos);
+  static bool collides(const convex& a, const vec2& a_pos, const convex& b, const vec2& b_pos);
+  
+  // tests of the tilemaps, against the blocks of the cells the other shape
+  // covers
+  static bool collides(const rectangle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos);
+  static bool collides(const circle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos);
+  static bool collides(const convex& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos);
+  static bool collides(const tilemap& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos);
+  
+  // kernels of the box and circle tests against convex shapes, shared with
+  // the spatial queries. the box has its upper left corner at min
+  static bool overlaps(const vec2& min, const vec2& size, const convex& b, const vec2& b_pos);
+  static bool overlaps(const vec2& center, float r, const convex& b, const vec2& b_pos);
+  
+  // whether one of the axes separates the projections of both vertex
+  // lists, each offset by its position. touching projections don't
+  static bool separated(
+    const vec2* axes, int naxes,
+    const vec2* a, int na, const vec2& a_pos,
+    const vec2* b, int nb, const vec2& b_pos
+  );
+  
+  // interval of the vertices offset by pos projected over axis
+  static void project(const vec2* v, int n, const vec2& pos, const vec2& axis, float& min, float& max);
+  
+  // closest point kernel of a rectangle and a circle. on contact also
+  // gives the penetration depth and the unit normal pointing from the
+  // rectangle to the circle, along which the circle must move by depth to
+  // stop touching
+  static bool penetration(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool penetration(const vec2& min, const vec2& size, const vec2& center, float r, vec2& normal, float& depth);
+  
+  // contacts of every pair, for the collision response. same as
+  // penetration, the normal points from a to b and b must move along it by
+  // depth to stop overlapping. the convex pairs take the separating axis of
+  // least overlap
+  static bool contact(const rectangle& a, const vec2& a_pos, const rectangle& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const circle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const rectangle& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const circle& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const convex& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth);
+  
+  // contacts with a tilemap are taken with its deepest block
+  static bool contact(const rectangle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const circle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const convex& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth);
+  static bool contact(const tilemap& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth);
+  
+  // kernels of the contacts of boxes, given by their upper left corner
+  // and their size, shared with the tilemaps
+  static bool contact(const vec2& a_min, const vec2& a_size, const vec2& b_min, const vec2& b_size, vec2& normal, float& depth);
+  static bool contact(const vec2& min, const vec2& size, const convex& b, const vec2& b_pos, vec2& normal, float& depth);
+  
+  // narrows normal and depth down to the axis where the projections of
+  // both vertex lists overlap the least, oriented from a to b. depth must
+  // start above any overlap. false if one of the axes separates them
+  static bool leastoverlap(
+    const vec2* axes, int naxes,
+    const vec2* a, int na, const vec2& a_pos,
+    const vec2* b, int nb, const vec2& b_pos,
+    vec2& normal, float& depth
+  );
+  
+  // same for the intervals of a and b projected over a single axis
+  static bool leastoverlap(const vec2& axis, float amin, float amax, float bmin, float bmax, vec2& normal, float& depth);
+  
+  // time of impact tests, with analytic solvers from toi.h
+  static bool impact(const rectangle& a, const body& a_body, const rectangle& b, const body& b_body, timediff dt, int steps, timediff& toi);
+  static bool impact(const rectangle& a, const body& a_body, const circle& b, const body& b_body, timediff dt, int steps, timediff& toi);
+  static bool impact(const circle& a, const body& a_body, const circle& b, const body& b_body, timediff dt, int steps, timediff& toi);
+  
+  // pairs without an analytic solver test the interpolation steps
+  template<typename A, typename B>
+  static bool impact(const A& a, const body& a_body, const B& b, const body& b_body, timediff dt, int steps, timediff& toi) {
+    for (int step = 0; step <= steps; step++) {
+      toi = dt*step/steps;
+      if (collides(a, a.getpos(a_body, toi), b, b.getpos(b_body, toi)))
+        return true;
+    }
+    return false;
+  }
+  
+  // motion of shape a relative to shape b: d + v*t + acc*t*t/2
+  static void relative(
+    const shape& a, const body& a_body, const shape& b, const body& b_body,
+    vec2& d, vec2& v, vec2& acc
+  ) {
+    d = a.getpos(a_body, 0) - b.getpos(b_body, 0);
+    v = vec2(a_body.xspeed - b_body.xspeed, a_body.yspeed - b_body.yspeed);
+    acc = vec2(a_body.xaccel - b_body.xaccel, a_body.yaccel - b_body.yaccel);
+  }
+};
+
+// =============================================================================
+// pair dispatch
+// =============================================================================
+
+typedef bool (*collidefunction)(const shape*, const vec2&, const shape*, const vec2&);
+typedef bool (*impactfunction)(const shape*, const body&, const shape*, const body&, timediff, int, timediff&);
+typedef bool (*contactfunction)(const shape*, const vec2&, const shape*, const vec2&, vec2&, float&);
+
+// calls the narrowphase test of shape types A and B, swapping the shapes
+// when B comes first in shapetypes
+template<
+  typename A, typename B,
+  bool ordered = (typeindex<A, shapetypes>::value <= typeindex<B, shapetypes>::value)
+>
+struct pairtest {
+  static bool test(const shape* a, const vec2& a_pos, const shape* b, const vec2& b_pos) {
+    return narrowphase::collides(*static_cast<const A*>(a), a_pos, *static_cast<const B*>(b), b_pos);
+  }
+  
+  static bool impact(const shape* a, const body& a_body, const shape* b, const body& b_body, timediff dt, int steps, timediff& toi) {
+    return narrowphase::impact(*static_cast<const A*>(a), a_body, *static_cast<const B*>(b), b_body, dt, steps, toi);
+  }
+  
+  static bool contact(const shape* a, const vec2& a_pos, const shape* b, const vec2& b_pos, vec2& normal, float& depth) {
+    return narrowphase::contact(*static_cast<const A*>(a), a_pos, *static_cast<const B*>(b), b_pos, normal, depth);
+  }
+};
+
+template<typename A, typename B>
+struct pairtest<A, B, false> {
+  static bool test(const shape* a, const vec2& a_pos, const shape* b, const vec2& b_pos) {
+    return pairtest<B, A>::test(b, b_pos, a, a_pos);
+  }
+  
+  static bool impact(const shape* a, const body& a_body, const shape* b, const body& b_body, timediff dt, int steps, timediff& toi) {
+    return pairtest<B, A>::impact(b, b_body, a, a_body, dt, steps, toi);
+  }
+  
+  // the swapped test gives the normal from b to a
+  static bool contact(const shape* a, const vec2& a_pos, const shape* b, const vec2& b_pos, vec2& normal, float& depth) {
+    if (!pairtest<B, A>::contact(b, b_pos, a, a_pos, normal, depth))
+      return false;
+    normal = -normal;
+    return true;
+  }
+};
+
+// table of the tests of all pairs of shape types, indexed by the type
+// identifiers of both shapes
+template<typename list>
+struct dispatchtable;
+
+template<typename... T>
+struct dispatchtable< shapelist<T...> > {
+  struct row {
+    collidefunction test[sizeof...(T)];
+    impactfunction impact[sizeof...(T)];
+    contactfunction contact[sizeof...(T)];
+  };
+  
+  template<typename A>
+  static constexpr row makerow() {
+    return row{ { &pairtest<A, T>::test... }, { &pairtest<A, T>::impact... }, { &pairtest<A, T>::contact... } };
+  }
+  
+  static constexpr row rows[sizeof...(T)] = { makerow<T>()... };
+};
+
+template<typename... T>
+constexpr typename dispatchtable< shapelist<T...> >::row dispatchtable< shapelist<T...> >::rows[sizeof...(T)];
+
+// constructors of the shape types, indexed by their identifiers, so a shape
+// is built from the position of its type parameter in shapenames
+typedef shape* (*shapefactory)(component::base*, object::signature&, const string&);
+
+template<typename T>
+shape* makeshape(component::base* owner, object::signature& sig, const string& name) {
+  return new T(owner, sig, name);
+}
+
+template<typename list>
+struct shapefactories;
+
+template<typename... T>
+struct shapefactories< shapelist<T...> > {
+  static constexpr shapefactory make[sizeof...(T)] = { &makeshape<T>... };
 };
 
+template<typename... T>
+constexpr shapefactory shapefactories< shapelist<T...> >::make[sizeof...(T)];
+
+// =============================================================================
+// shape class implementation
+// =============================================================================
+
+int shape::substeps(timediff dt, const body& self, const shape* other, const body& otherbody, int maxsteps) const {
+  // bounds the relative path length by |v|*dt + |a|*dt*dt/2
+  vec2 v(self.xspeed - otherbody.xspeed, self.yspeed - otherbody.yspeed);
+  vec2 a(self.xaccel - otherbody.xaccel, self.yaccel - otherbody.yaccel);
+  float path = v.length()*dt + a.length()*dt*dt*0.5;
+  
+  float size = std::min(extent(), other->extent());
+  if (path <= size)
+    return 1;
+  if (path >= size*maxsteps)
+    return maxsteps;
+  return (int)std::ceil(path/size);
+}
+
+bool shape::checkcollision(timediff dt, const body& self, const shape* other, const body& otherbody, int steps, timediff& toi) const {
+  collidefunction test = dispatchtable<shapetypes>::rows[type].test[other->type];
+  
+  // iterates over all steps to check collision. step times are computed
+  // from the step index, so no error accumulates along the loop
+  for (int step = 0; step <= steps; step++) {
+    timediff local_dt = dt*step/steps;
+    if (test(this, getpos(self, local_dt), other, other->getpos(otherbody, local_dt))) {
+      toi = local_dt;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+bool shape::timeofimpact(timediff dt, const body& self, const shape* other, const body& otherbody, int steps, timediff& toi) const {
+  return dispatchtable<shapetypes>::rows[type].impact[other->type](this, self, other, otherbody, dt, steps, toi);
+}
+
+bool shape::contact(const vec2& pos, const shape* other, const vec2& otherpos, vec2& normal, float& depth) const {
+  return dispatchtable<shapetypes>::rows[type].contact[other->type](this, pos, other, otherpos, normal, depth);
+}
+
 // =============================================================================
 // rectangle class implementation
 // =============================================================================
 
 rectangle::rectangle(component::base* owner, object::signature & sig, const string& name)
-: shape(owner, sig, name) {
+: shape(typeindex<rectangle, shapetypes>::value, owner, sig, name) {
   // init w
   owner->write(this->name + "w", eval<float>(sig[this->name + "w"]));
   w = owner->fetch<float>(this->name + "w");
@@ -157,47 +832,28 @@ rectangle::rectangle(component::base* owner, object::signature & sig, const stri
     throw evil("Trying to create rectangle without width and/or height inside rectangle shape class");
 }
 
-string rectangle::type() const { return "rectangle"; }
+aabb rectangle::bounds(const vec2& pos) const {
+  return aabb(pos.x, pos.y, pos.x + w, pos.y + h);
+}
 
-// RECTANGLE ABSTRACT FUNCTIONS IMPLEMENTATION MARK
+float rectangle::extent() const {
+  return std::min<float>(w, h);
+}
 
-bool rectangle::collidesrectangle(rectangle* other, const vector3& this_pos, const vector3& other_pos) {
-  // De Morgan of:
-  // first rect totally right the second rect OR
-  // second rect totally right the first rect OR
-  // first rect totally below the second rect OR
-  // second rect totally below the first rect
-  return (
-     this_pos.x() <= other_pos.x() + other->w &&
-    other_pos.x() <=  this_pos.x() +        w &&
-     this_pos.y() <= other_pos.y() + other->h &&
-    other_pos.y() <=  this_pos.y() +        h
-  );
+bool rectangle::overlaps(const vec2& pos, const aabb& box) const {
+  return bounds(pos).overlaps(box);
 }
 
-bool rectangle::collidescircle(circle* other, const vector3& this_pos, const vector3& other_pos) {
-  // other_pos represents the center of the circle. this condition checks
-  // if this point is inside the rectangle, which means that
-  // collision happens.
-  if (
-    other_pos.x() >= this_pos.x() && other_pos.x() < this_pos.x() + w &&
-    other_pos.y() >= this_pos.y() && other_pos.y() < this_pos.y() + h
-  )
-    return true;
-  
-  // collision happens if any line segment of the rectangle collides with
-  // the circle.
-  vector3 horizontal = vector3(w, 0);
-  vector3 vertical = vector3(0, h);
-  vector3 upper_left = this_pos;
-  vector3 upper_right = this_pos + horizontal;
-  vector3 lower_left = this_pos + vertical;
-  return (
-    circle::linesegcollision(upper_left, horizontal, other_pos, other->r) ||
-    circle::linesegcollision(upper_left, vertical, other_pos, other->r) ||
-    circle::linesegcollision(upper_right, vertical, other_pos, other->r) ||
-    circle::linesegcollision(lower_left, horizontal, other_pos, other->r)
+bool rectangle::overlaps(const vec2& pos, const vec2& center, float radius) const {
+  vec2 closest(
+    std::min(std::max(center.x, pos.x), pos.x + w),
+    std::min(std::max(center.y, pos.y), pos.y + h)
   );
+  return within(closest, center, radius);
+}
+
+bool rectangle::raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const {
+  return bounds(pos).raycast(from, to, t, normal);
 }
 
 // =============================================================================
@@ -205,7 +861,7 @@ bool rectangle::collidescircle(circle* other, const vector3& this_pos, const vec
 // =============================================================================
 
 circle::circle(component::base* owner, object::signature & sig, const string& name)
-: shape(owner, sig, name) {
+: shape(typeindex<circle, shapetypes>::value, owner, sig, name) {
   // init r
   owner->write(this->name + "r", eval<float>(sig[this->name + "r"]));
   r = owner->fetch<float>(this->name + "r");
@@ -214,63 +870,745 @@ circle::circle(component::base* owner, object::signature & sig, const string& na
     throw evil("Trying to create circle without radius inside circle shape class");
 }
 
-bool circle::linesegcollision(const vector3& v0, const vector3& v, const vector3& center, float radius) {
-  // point of the line segment closest to the center of the circle
-  vector3 closest;
+aabb circle::bounds(const vec2& pos) const {
+  return aabb(pos.x - r, pos.y - r, pos.x + r, pos.y + r);
+}
+
+float circle::extent() const {
+  return 2*r;
+}
+
+bool circle::overlaps(const vec2& pos, const aabb& box) const {
+  vec2 closest(
+    std::min(std::max(pos.x, box.xmin), box.xmax),
+    std::min(std::max(pos.y, box.ymin), box.ymax)
+  );
+  return within(closest, pos, r);
+}
+
+bool circle::overlaps(const vec2& pos, const vec2& center, float radius) const {
+  return within(pos, center, r + radius);
+}
+
+bool circle::raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const {
+  // solves |d + s*t| = r, d being the start relative to the center
+  vec2 d = from - pos;
+  vec2 s = to - from;
+  float c = d.length_sq() - r*r;
+  if (c <= 0) {
+    t = 0;
+    normal = vec2(0, 0);
+    return true;
+  }
   
-  // the scalar projection of the position vector of the circle, relative to
-  // the begining of the line segment, over the line segment
-  float scalar_proj = (center - v0).scalarproj(v);
+  // starting outside, the segment must head towards the center
+  float a = s.length_sq();
+  float b = d.dot(s);
+  if (a == 0 || b >= 0)
+    return false;
+  float delta = b*b - a*c;
+  if (delta < 0)
+    return false;
   
-  // in this case, the closest point is the begining of the line segment
-  if (scalar_proj < 0)
-    closest = v0;
-  // in this case, the closest point is the end of the line segment
-  else if (scalar_proj > ((vector3&)v).length())
-    closest = v0 + v;
-  // in this case, the closest point is the begining of the line segment plus
-  // the projection of the position vector of the circle, relative to the
-  // begining of the line segment, over the line segment
-  else
-    closest = v0 + v.unitvec()*scalar_proj;
+  float hit = (-b - std::sqrt(delta))/a;
+  if (hit > 1)
+    return false;
+  t = hit;
+  normal = normalize_or_zero(d + s*hit);
+  return true;
+}
+
+// =============================================================================
+// convex class implementation
+// =============================================================================
+
+convex::convex(int type, component::base* owner, object::signature & sig, const string& name)
+: shape(type, owner, sig, name), pivot(0, 0), reshaped(true), cachedtheta(0) {
+  // init theta
+  owner->write(this->name + "theta", eval<float>(sig[this->name + "theta"]));
+  theta = owner->fetch<float>(this->name + "theta");
+}
+
+void convex::validate() {
+  if (outline.size() < 3)
+    throw evil("Trying to create convex shape with less than three vertices inside convex shape class");
   
-  // intersection happens if the shortest distance between the center and the
-  // line segment is less or equal to the radius
-  return ((center - closest).length() <= radius);
+  // twice the signed area, negative for clockwise outlines
+  float area = 0;
+  for (size_t i = 0; i < outline.size(); i++)
+    area += outline[i].cross(outline[(i + 1) % outline.size()]);
+  if (area < 0)
+    std::reverse(outline.begin(), outline.end());
+  
+  // every corner of a convex outline turns the same way
+  for (size_t i = 0; i < outline.size(); i++) {
+    const vec2& a = outline[i];
+    const vec2& b = outline[(i + 1) % outline.size()];
+    const vec2& c = outline[(i + 2) % outline.size()];
+    if ((b - a).cross(c - b) < 0)
+      throw evil("Trying to create concave shape inside convex shape class");
+  }
 }
 
-string circle::type() const { return "circle"; }
+bool convex::prepare() {
+  if (!reshaped && theta == cachedtheta)
+    return false;
+  reshaped = false;
+  cachedtheta = theta;
+  
+  vertices.resize(outline.size());
+  transformpoints(transform2d::around(pivot, cachedtheta), &outline[0], &vertices[0], outline.size());
+  
+  // outward edge normals of the counterclockwise vertices
+  normals.resize(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    vec2 edge = vertices[(i + 1) % vertices.size()] - vertices[i];
+    normals[i] = normalize_or_zero(vec2(edge.y, -edge.x));
+  }
+  
+  hull = aabb(vertices[0].x, vertices[0].y, vertices[0].x, vertices[0].y);
+  for (size_t i = 1; i < vertices.size(); i++)
+    hull.merge(aabb(vertices[i].x, vertices[i].y, vertices[i].x, vertices[i].y));
+  
+  return true;
+}
 
-// CIRCLE ABSTRACT FUNCTIONS IMPLEMENTATION MARK
+aabb convex::bounds(const vec2& pos) const {
+  return aabb(hull.xmin + pos.x, hull.ymin + pos.y, hull.xmax + pos.x, hull.ymax + pos.y);
+}
 
-bool circle::collidesrectangle(rectangle* other, const vector3& this_pos, const vector3& other_pos) {
-  // this_pos represents the center of the circle. this condition checks
-  // if this point is inside the rectangle, which means that
-  // collision happens.
-  if (
-    this_pos.x() >= other_pos.x() && this_pos.x() < other_pos.x() + other->w &&
-    this_pos.y() >= other_pos.y() && this_pos.y() < other_pos.y() + other->h
-  )
-    return true;
+float convex::extent() const {
+  return std::min(hull.xmax - hull.xmin, hull.ymax - hull.ymin);
+}
+
+bool convex::overlaps(const vec2& pos, const aabb& box) const {
+  return narrowphase::overlaps(vec2(box.xmin, box.ymin), vec2(box.xmax - box.xmin, box.ymax - box.ymin), *this, pos);
+}
+
+bool convex::overlaps(const vec2& pos, const vec2& center, float radius) const {
+  return narrowphase::overlaps(center, radius, *this, pos);
+}
+
+bool convex::raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const {
+  // clips the segment against the half plane of every edge. the segment
+  // enters the polygon at the last entering edge and leaves it at the first
+  // leaving one
+  vec2 s = to - from;
+  float enter = 0, exit = 1;
+  normal = vec2(0, 0);
+  for (size_t i = 0; i < vertices.size(); i++) {
+    float distance = normals[i].dot(from - (pos + vertices[i]));
+    float approach = normals[i].dot(s);
+    if (approach == 0) {
+      if (distance > 0)
+        return false;
+      continue;
+    }
+    
+    float crossing = -distance/approach;
+    if (approach < 0) {
+      if (crossing > enter) {
+        enter = crossing;
+        normal = normals[i];
+      }
+    } else
+      exit = std::min(exit, crossing);
+    if (enter > exit)
+      return false;
+  }
+  
+  t = enter;
+  return true;
+}
+
+// =============================================================================
+// obb class implementation
+// =============================================================================
+
+obb::obb(component::base* owner, object::signature & sig, const string& name)
+: convex(typeindex<obb, shapetypes>::value, owner, sig, name), cachedw(0), cachedh(0) {
+  // init w
+  owner->write(this->name + "w", eval<float>(sig[this->name + "w"]));
+  w = owner->fetch<float>(this->name + "w");
+  
+  // init h
+  owner->write(this->name + "h", eval<float>(sig[this->name + "h"]));
+  h = owner->fetch<float>(this->name + "h");
+  
+  if (w <= 0 || h <= 0)
+    throw evil("Trying to create obb without width and/or height inside obb shape class");
+  
+  prepare();
+}
+
+bool obb::prepare() {
+  if (w != cachedw || h != cachedh) {
+    cachedw = w;
+    cachedh = h;
+    outline.assign(1, vec2(0, 0));
+    outline.push_back(vec2(0, cachedh));
+    outline.push_back(vec2(cachedw, cachedh));
+    outline.push_back(vec2(cachedw, 0));
+    validate();
+    pivot = vec2(cachedw*0.5f, cachedh*0.5f);
+    reshaped = true;
+  }
+  return convex::prepare();
+}
+
+// =============================================================================
+// polygon class implementation
+// =============================================================================
+
+polygon::polygon(component::base* owner, object::signature & sig, const string& name)
+: convex(typeindex<polygon, shapetypes>::value, owner, sig, name) {
+  std::istringstream points(sig[this->name + "points"]);
+  float px, py;
+  while (points >> px >> py)
+    outline.push_back(vec2(px, py));
+  
+  validate();
+  prepare();
+}
+
+// =============================================================================
+// tilemap class implementation
+// =============================================================================
+
+tilemap::tilemap(component::base* owner, object::signature & sig, const string& name)
+: shape(typeindex<tilemap, shapetypes>::value, owner, sig, name), columns(0), rows(0) {
+  tilewidth = eval<float>(sig[this->name + "tilewidth"]);
+  tileheight = eval<float>(sig[this->name + "tileheight"]);
+  if (tilewidth <= 0 || tileheight <= 0)
+    throw evil("Trying to create tilemap without tile width and/or height inside tilemap shape class");
+  
+  // inline rows are separated by spaces, file rows by line breaks, where
+  // spaces are empty cells
+  vector<string> grid;
+  string path = sig[this->name + "file"];
+  if (path != "") {
+    std::ifstream file(path.c_str());
+    if (!file)
+      throw evil("Could not open the tiles file of a tilemap inside tilemap shape class");
+    string line;
+    while (std::getline(file, line)) {
+      if (line.size() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      grid.push_back(line);
+    }
+  } else {
+    std::istringstream tiles(sig[this->name + "tiles"]);
+    string row;
+    while (tiles >> row)
+      grid.push_back(row);
+  }
+  
+  if (grid.empty())
+    throw evil("Trying to create tilemap without tiles inside tilemap shape class");
+  merge(grid);
+}
+
+void tilemap::merge(const vector<string>& grid) {
+  rows = grid.size();
+  columns = 0;
+  for (int r = 0; r < rows; r++)
+    columns = std::max(columns, (int)grid[r].size());
+  
+  vector<bool> solid(rows*columns, false);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < (int)grid[r].size(); c++) {
+      char cell = grid[r][c];
+      solid[r*columns + c] = (cell != '0' && cell != '.' && cell != ' ');
+    }
+  }
   
-  // collision happens if any line segment of the rectangle collides with
-  // the circle.
-  vector3 horizontal = vector3(other->w, 0);
-  vector3 vertical = vector3(0, other->h);
-  vector3 upper_left = other_pos;
-  vector3 upper_right = other_pos + horizontal;
-  vector3 lower_left = other_pos + vertical;
+  // every free solid cell, in row order, starts a block as wide as the run
+  // of free solid cells from it, which then grows down while the row below
+  // is free and solid all along it
+  cells.assign(rows*columns, -1);
+  blocks.clear();
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < columns; c++) {
+      if (!solid[r*columns + c] || cells[r*columns + c] >= 0)
+        continue;
+      
+      block b = { c, r, 1, 1 };
+      while (c + b.columns < columns && solid[r*columns + c + b.columns] && cells[r*columns + c + b.columns] < 0)
+        b.columns++;
+      for (bool grows = true; grows && r + b.rows < rows;) {
+        int below = (r + b.rows)*columns;
+        for (int k = c; k < c + b.columns && grows; k++)
+          grows = solid[below + k] && cells[below + k] < 0;
+        if (grows)
+          b.rows++;
+      }
+      
+      for (int i = r; i < r + b.rows; i++) {
+        for (int k = c; k < c + b.columns; k++)
+          cells[i*columns + k] = blocks.size();
+      }
+      blocks.push_back(b);
+    }
+  }
+}
+
+template<typename F>
+bool tilemap::visit(const vec2& pos, const aabb& area, F test) const {
+  // cells covered by area, clamped to the grid before converting to int.
+  // the division can round a side that touches a cell edge exactly to the
+  // cell before it, so one more cell is looked at on every side and the
+  // blocks found there are compared to area by their edges. touching
+  // blocks are visited, as touching shapes collide
+  float left = std::floor((area.xmin - pos.x)/tilewidth) - 1;
+  float right = std::floor((area.xmax - pos.x)/tilewidth) + 1;
+  float top = std::floor((area.ymin - pos.y)/tileheight) - 1;
+  float bottom = std::floor((area.ymax - pos.y)/tileheight) + 1;
+  if (right < 0 || bottom < 0 || left >= columns || top >= rows)
+    return false;
+  int cmin = std::max(left, 0.0f), cmax = std::min(right, columns - 1.0f);
+  int rmin = std::max(top, 0.0f), rmax = std::min(bottom, rows - 1.0f);
+  
+  for (int r = rmin; r <= rmax; r++) {
+    for (int c = cmin; c <= cmax; c++) {
+      int index = cells[r*columns + c];
+      if (index < 0)
+        continue;
+      
+      // the rest of the row inside the block is the same block
+      const block& b = blocks[index];
+      bool first = (c == std::max(b.column, cmin) && r == std::max(b.row, rmin));
+      c = std::min(b.column + b.columns - 1, cmax);
+      if (!first)
+        continue;
+      
+      vec2 min(pos.x + b.column*tilewidth, pos.y + b.row*tileheight);
+      vec2 size(b.columns*tilewidth, b.rows*tileheight);
+      if (min.x > area.xmax || min.y > area.ymax || min.x + size.x < area.xmin || min.y + size.y < area.ymin)
+        continue;
+      if (test(min, size))
+        return true;
+    }
+  }
+  return false;
+}
+
+aabb tilemap::bounds(const vec2& pos) const {
+  return aabb(pos.x, pos.y, pos.x + columns*tilewidth, pos.y + rows*tileheight);
+}
+
+float tilemap::extent() const {
+  return std::min(tilewidth, tileheight);
+}
+
+bool tilemap::overlaps(const vec2& pos, const aabb& box) const {
+  return visit(pos, box, [](const vec2&, const vec2&) { return true; });
+}
+
+bool tilemap::overlaps(const vec2& pos, const vec2& center, float radius) const {
+  aabb area(center.x - radius, center.y - radius, center.x + radius, center.y + radius);
+  return visit(pos, area, [&](const vec2& min, const vec2& size) {
+    vec2 closest(
+      std::min(std::max(center.x, min.x), min.x + size.x),
+      std::min(std::max(center.y, min.y), min.y + size.y)
+    );
+    return within(closest, center, radius);
+  });
+}
+
+bool tilemap::raycast(const vec2& pos, const vec2& from, const vec2& to, float& t, vec2& normal) const {
+  // the closest hit of the blocks the segment bounds cover
+  aabb area(std::min(from.x, to.x), std::min(from.y, to.y), std::max(from.x, to.x), std::max(from.y, to.y));
+  bool hit = false;
+  visit(pos, area, [&](const vec2& min, const vec2& size) {
+    float s;
+    vec2 n;
+    if (aabb(min.x, min.y, min.x + size.x, min.y + size.y).raycast(from, to, s, n) && (!hit || s < t)) {
+      hit = true;
+      t = s;
+      normal = n;
+    }
+    return false;
+  });
+  return hit;
+}
+
+// =============================================================================
+// narrowphase implementation
+// =============================================================================
+
+bool narrowphase::collides(const rectangle& a, const vec2& a_pos, const rectangle& b, const vec2& b_pos) {
+  // De Morgan of:
+  // first rect totally right the second rect OR
+  // second rect totally right the first rect OR
+  // first rect totally below the second rect OR
+  // second rect totally below the first rect
   return (
-    circle::linesegcollision(upper_left, horizontal, this_pos, r) ||
-    circle::linesegcollision(upper_left, vertical, this_pos, r) ||
-    circle::linesegcollision(upper_right, vertical, this_pos, r) ||
-    circle::linesegcollision(lower_left, horizontal, this_pos, r)
+    a_pos.x <= b_pos.x + b.w &&
+    b_pos.x <= a_pos.x + a.w &&
+    a_pos.y <= b_pos.y + b.h &&
+    b_pos.y <= a_pos.y + a.h
+  );
+}
+
+bool narrowphase::collides(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos) {
+  vec2 normal;
+  float depth;
+  return penetration(a, a_pos, b, b_pos, normal, depth);
+}
+
+bool narrowphase::penetration(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth) {
+  return penetration(a_pos, vec2(a.w, a.h), b_pos, b.r, normal, depth);
+}
+
+bool narrowphase::penetration(const vec2& min, const vec2& size, const vec2& b_pos, float r, vec2& normal, float& depth) {
+  // the point of the rectangle closest to the center of the circle is the
+  // center clamped to the rectangle
+  float left = min.x, right = min.x + size.x;
+  float top = min.y, bottom = min.y + size.y;
+  vec2 closest(
+    std::min(std::max(b_pos.x, left), right),
+    std::min(std::max(b_pos.y, top), bottom)
   );
+  
+  vec2 d = b_pos - closest;
+  float distance_sq = d.length_sq();
+  if (distance_sq > r*r)
+    return false;
+  
+  // center outside the rectangle, the only case taking a square root
+  if (distance_sq > 0) {
+    float distance = std::sqrt(distance_sq);
+    normal = d*(1/distance);
+    depth = r - distance;
+    return true;
+  }
+  
+  // center inside the rectangle. pushes the circle out through the
+  // closest side
+  float toleft = b_pos.x - left, toright = right - b_pos.x;
+  float totop = b_pos.y - top, tobottom = bottom - b_pos.y;
+  float side = std::min(std::min(toleft, toright), std::min(totop, tobottom));
+  if (side == toleft)
+    normal = vec2(-1, 0);
+  else if (side == toright)
+    normal = vec2(1, 0);
+  else if (side == totop)
+    normal = vec2(0, -1);
+  else
+    normal = vec2(0, 1);
+  depth = r + side;
+  return true;
 }
 
-bool circle::collidescircle(circle* other, const vector3& this_pos, const vector3& other_pos) {
+bool narrowphase::collides(const circle& a, const vec2& a_pos, const circle& b, const vec2& b_pos) {
   // collision happens if distance center-to-center is less or equal than the sum of the radii
-  return ((this_pos - other_pos).length() <= r + other->r);
+  return within(a_pos, b_pos, a.r + b.r);
+}
+
+void narrowphase::project(const vec2* v, int n, const vec2& pos, const vec2& axis, float& min, float& max) {
+  min = max = v[0].dot(axis);
+  for (int i = 1; i < n; i++) {
+    float p = v[i].dot(axis);
+    min = std::min(min, p);
+    max = std::max(max, p);
+  }
+  
+  float offset = pos.dot(axis);
+  min += offset;
+  max += offset;
+}
+
+bool narrowphase::separated(
+  const vec2* axes, int naxes,
+  const vec2* a, int na, const vec2& a_pos,
+  const vec2* b, int nb, const vec2& b_pos
+) {
+  for (int i = 0; i < naxes; i++) {
+    float amin, amax, bmin, bmax;
+    project(a, na, a_pos, axes[i], amin, amax);
+    project(b, nb, b_pos, axes[i], bmin, bmax);
+    if (amax < bmin || bmax < amin)
+      return true;
+  }
+  return false;
+}
+
+bool narrowphase::collides(const rectangle& a, const vec2& a_pos, const convex& b, const vec2& b_pos) {
+  return overlaps(a_pos, vec2(a.w, a.h), b, b_pos);
+}
+
+bool narrowphase::overlaps(const vec2& min, const vec2& size, const convex& b, const vec2& b_pos) {
+  if (!aabb(min.x, min.y, min.x + size.x, min.y + size.y).overlaps(b.bounds(b_pos)))
+    return false;
+  
+  // the box overlap already covers the axes of the rectangle
+  vec2 corners[4] = { vec2(0, 0), vec2(0, size.y), vec2(size.x, size.y), vec2(size.x, 0) };
+  int n = b.vertices.size();
+  return !separated(&b.normals[0], n, corners, 4, min, &b.vertices[0], n, b_pos);
+}
+
+bool narrowphase::collides(const circle& a, const vec2& a_pos, const convex& b, const vec2& b_pos) {
+  return overlaps(a_pos, a.r, b, b_pos);
+}
+
+bool narrowphase::overlaps(const vec2& a_pos, float r, const convex& b, const vec2& b_pos) {
+  if (!aabb(a_pos.x - r, a_pos.y - r, a_pos.x + r, a_pos.y + r).overlaps(b.bounds(b_pos)))
+    return false;
+  
+  // the circle projects to its center plus and minus the radius
+  vec2 center = a_pos - b_pos;
+  int n = b.vertices.size();
+  for (int i = 0; i < n; i++) {
+    float c = center.dot(b.normals[i]);
+    float min, max;
+    project(&b.vertices[0], n, vec2(0, 0), b.normals[i], min, max);
+    if (c + r < min || max < c - r)
+      return false;
+  }
+  
+  // the last axis runs from the closest vertex to the center
+  int closest = 0;
+  for (int i = 1; i < n; i++) {
+    if (dist_sq(b.vertices[i], center) < dist_sq(b.vertices[closest], center))
+      closest = i;
+  }
+  vec2 axis = normalize_or_zero(center - b.vertices[closest]);
+  float c = center.dot(axis);
+  float min, max;
+  project(&b.vertices[0], n, vec2(0, 0), axis, min, max);
+  return !(c + r < min || max < c - r);
+}
+
+bool narrowphase::collides(const convex& a, const vec2& a_pos, const convex& b, const vec2& b_pos) {
+  if (!a.bounds(a_pos).overlaps(b.bounds(b_pos)))
+    return false;
+  
+  int na = a.vertices.size();
+  int nb = b.vertices.size();
+  return (
+    !separated(&a.normals[0], na, &a.vertices[0], na, a_pos, &b.vertices[0], nb, b_pos) &&
+    !separated(&b.normals[0], nb, &a.vertices[0], na, a_pos, &b.vertices[0], nb, b_pos)
+  );
+}
+
+bool narrowphase::leastoverlap(const vec2& axis, float amin, float amax, float bmin, float bmax, vec2& normal, float& depth) {
+  if (amax < bmin || bmax < amin)
+    return false;
+  
+  // b leaves a by the side of the interval it is closest to
+  float forward = amax - bmin;
+  float backward = bmax - amin;
+  if (forward <= backward && forward < depth) {
+    normal = axis;
+    depth = forward;
+  } else if (backward < forward && backward < depth) {
+    normal = -axis;
+    depth = backward;
+  }
+  return true;
+}
+
+bool narrowphase::leastoverlap(
+  const vec2* axes, int naxes,
+  const vec2* a, int na, const vec2& a_pos,
+  const vec2* b, int nb, const vec2& b_pos,
+  vec2& normal, float& depth
+) {
+  for (int i = 0; i < naxes; i++) {
+    float amin, amax, bmin, bmax;
+    project(a, na, a_pos, axes[i], amin, amax);
+    project(b, nb, b_pos, axes[i], bmin, bmax);
+    if (!leastoverlap(axes[i], amin, amax, bmin, bmax, normal, depth))
+      return false;
+  }
+  return true;
+}
+
+bool narrowphase::contact(const rectangle& a, const vec2& a_pos, const rectangle& b, const vec2& b_pos, vec2& normal, float& depth) {
+  return contact(a_pos, vec2(a.w, a.h), b_pos, vec2(b.w, b.h), normal, depth);
+}
+
+bool narrowphase::contact(const vec2& a_min, const vec2& a_size, const vec2& b_min, const vec2& b_size, vec2& normal, float& depth) {
+  depth = std::numeric_limits<float>::max();
+  return (
+    leastoverlap(vec2(1, 0), a_min.x, a_min.x + a_size.x, b_min.x, b_min.x + b_size.x, normal, depth) &&
+    leastoverlap(vec2(0, 1), a_min.y, a_min.y + a_size.y, b_min.y, b_min.y + b_size.y, normal, depth)
+  );
+}
+
+bool narrowphase::contact(const rectangle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth) {
+  return penetration(a, a_pos, b, b_pos, normal, depth);
+}
+
+bool narrowphase::contact(const circle& a, const vec2& a_pos, const circle& b, const vec2& b_pos, vec2& normal, float& depth) {
+  float r = a.r + b.r;
+  vec2 d = b_pos - a_pos;
+  float distance_sq = d.length_sq();
+  if (distance_sq > r*r)
+    return false;
+  
+  // concentric circles have no normal of their own, any axis will do
+  float distance = std::sqrt(distance_sq);
+  normal = distance > 0 ? d*(1/distance) : vec2(0, -1);
+  depth = r - distance;
+  return true;
+}
+
+bool narrowphase::contact(const rectangle& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth) {
+  return contact(a_pos, vec2(a.w, a.h), b, b_pos, normal, depth);
+}
+
+bool narrowphase::contact(const vec2& min, const vec2& size, const convex& b, const vec2& b_pos, vec2& normal, float& depth) {
+  vec2 corners[4] = { vec2(0, 0), vec2(0, size.y), vec2(size.x, size.y), vec2(size.x, 0) };
+  vec2 axes[2] = { vec2(1, 0), vec2(0, 1) };
+  int n = b.vertices.size();
+  depth = std::numeric_limits<float>::max();
+  return (
+    leastoverlap(axes, 2, corners, 4, min, &b.vertices[0], n, b_pos, normal, depth) &&
+    leastoverlap(&b.normals[0], n, corners, 4, min, &b.vertices[0], n, b_pos, normal, depth)
+  );
+}
+
+bool narrowphase::contact(const circle& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth) {
+  // same axes as the overlap kernel, the circle projecting to its center
+  // plus and minus the radius
+  vec2 center = a_pos - b_pos;
+  float r = a.r;
+  int n = b.vertices.size();
+  depth = std::numeric_limits<float>::max();
+  int closest = 0;
+  for (int i = 0; i < n; i++) {
+    float c = center.dot(b.normals[i]);
+    float min, max;
+    project(&b.vertices[0], n, vec2(0, 0), b.normals[i], min, max);
+    if (!leastoverlap(b.normals[i], c - r, c + r, min, max, normal, depth))
+      return false;
+    if (dist_sq(b.vertices[i], center) < dist_sq(b.vertices[closest], center))
+      closest = i;
+  }
+  
+  vec2 axis = normalize_or_zero(center - b.vertices[closest]);
+  if (axis == vec2(0, 0))
+    return true;
+  float c = center.dot(axis);
+  float min, max;
+  project(&b.vertices[0], n, vec2(0, 0), axis, min, max);
+  return leastoverlap(axis, c - r, c + r, min, max, normal, depth);
+}
+
+bool narrowphase::contact(const convex& a, const vec2& a_pos, const convex& b, const vec2& b_pos, vec2& normal, float& depth) {
+  int na = a.vertices.size();
+  int nb = b.vertices.size();
+  depth = std::numeric_limits<float>::max();
+  return (
+    leastoverlap(&a.normals[0], na, &a.vertices[0], na, a_pos, &b.vertices[0], nb, b_pos, normal, depth) &&
+    leastoverlap(&b.normals[0], nb, &a.vertices[0], na, a_pos, &b.vertices[0], nb, b_pos, normal, depth)
+  );
+}
+
+bool narrowphase::collides(const rectangle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos) {
+  // every block the bounds of the rectangle cover overlaps it
+  return b.visit(b_pos, a.bounds(a_pos), [](const vec2&, const vec2&) { return true; });
+}
+
+bool narrowphase::collides(const circle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos) {
+  return b.overlaps(b_pos, a_pos, a.r);
+}
+
+bool narrowphase::collides(const convex& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos) {
+  return b.visit(b_pos, a.bounds(a_pos), [&](const vec2& min, const vec2& size) {
+    return overlaps(min, size, a, a_pos);
+  });
+}
+
+bool narrowphase::collides(const tilemap& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos) {
+  return a.visit(a_pos, b.bounds(b_pos), [&](const vec2& min, const vec2& size) {
+    return b.overlaps(b_pos, aabb(min.x, min.y, min.x + size.x, min.y + size.y));
+  });
+}
+
+bool narrowphase::contact(const rectangle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth) {
+  bool found = false;
+  b.visit(b_pos, a.bounds(a_pos), [&](const vec2& min, const vec2& size) {
+    vec2 n;
+    float d;
+    if (contact(a_pos, vec2(a.w, a.h), min, size, n, d) && (!found || d > depth)) {
+      found = true;
+      normal = n;
+      depth = d;
+    }
+    return false;
+  });
+  return found;
+}
+
+bool narrowphase::contact(const circle& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth) {
+  // the block kernel gives the normal from the block to the circle
+  bool found = false;
+  b.visit(b_pos, a.bounds(a_pos), [&](const vec2& min, const vec2& size) {
+    vec2 n;
+    float d;
+    if (penetration(min, size, a_pos, a.r, n, d) && (!found || d > depth)) {
+      found = true;
+      normal = -n;
+      depth = d;
+    }
+    return false;
+  });
+  return found;
+}
+
+bool narrowphase::contact(const convex& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth) {
+  bool found = false;
+  b.visit(b_pos, a.bounds(a_pos), [&](const vec2& min, const vec2& size) {
+    vec2 n;
+    float d;
+    if (contact(min, size, a, a_pos, n, d) && (!found || d > depth)) {
+      found = true;
+      normal = -n;
+      depth = d;
+    }
+    return false;
+  });
+  return found;
+}
+
+bool narrowphase::contact(const tilemap& a, const vec2& a_pos, const tilemap& b, const vec2& b_pos, vec2& normal, float& depth) {
+  bool found = false;
+  a.visit(a_pos, b.bounds(b_pos), [&](const vec2& amin, const vec2& asize) {
+    aabb area(amin.x, amin.y, amin.x + asize.x, amin.y + asize.y);
+    b.visit(b_pos, area, [&](const vec2& bmin, const vec2& bsize) {
+      vec2 n;
+      float d;
+      if (contact(amin, asize, bmin, bsize, n, d) && (!found || d > depth)) {
+        found = true;
+        normal = n;
+        depth = d;
+      }
+      return false;
+    });
+    return false;
+  });
+  return found;
+}
+
+bool narrowphase::impact(const rectangle& a, const body& a_body, const rectangle& b, const body& b_body, timediff dt, int, timediff& toi) {
+  vec2 d, v, acc;
+  relative(a, a_body, b, b_body, d, v, acc);
+  return toirectangles(d, v, acc, a.w, a.h, b.w, b.h, dt, toi);
+}
+
+bool narrowphase::impact(const rectangle& a, const body& a_body, const circle& b, const body& b_body, timediff dt, int, timediff& toi) {
+  // the solver takes the circle relative to the rectangle
+  vec2 d, v, acc;
+  relative(b, b_body, a, a_body, d, v, acc);
+  return toirectanglecircle(d, v, acc, a.w, a.h, b.r, dt, toi);
+}
+
+bool narrowphase::impact(const circle& a, const body& a_body, const circle& b, const body& b_body, timediff dt, int, timediff& toi) {
+  vec2 d, v, acc;
+  relative(a, a_body, b, b_body, d, v, acc);
+  return toicircles(d, v, acc, a.r + b.r, dt, toi);
 }
 
 #endif
@@ -0,0 +1,110 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <vector>
+#include <algorithm>
+#include "linearalgebra.h"
+
+// sequential impulse solver of the contacts of a frame. each contact pushes
+// its two bodies apart along its normal, with an accumulated impulse kept
+// non negative so contacts never pull. contacts are stored in structure of
+// arrays layout and solved in the order they were added, against velocities
+// indexed by body.
+//
+// contacts start from the impulse they ended the last frame with, so
+// resting stacks converge in a few iterations instead of starting over.
+class contactsolver {
+  public:
+    // fraction of the penetration corrected per second, over dt, and the
+    // depth left uncorrected so resting contacts don't jitter
+    static constexpr float baumgarte = 0.2f;
+    static constexpr float slop = 0.5f;
+    
+  private:
+    std::vector<int> body1, body2;
+    std::vector<float> inversemass1, inversemass2;
+    std::vector<float> nx, ny;
+    std::vector<float> depth;
+    
+    // effective mass along the normal, target separating speed and
+    // accumulated impulse of every contact
+    std::vector<float> mass;
+    std::vector<float> bias;
+    std::vector<float> impulses;
+    
+  public:
+    void clear() {
+      body1.clear(); body2.clear();
+      inversemass1.clear(); inversemass2.clear();
+      nx.clear(); ny.clear();
+      depth.clear();
+      mass.clear();
+      bias.clear();
+      impulses.clear();
+    }
+    
+    int size() const {
+      return body1.size();
+    }
+    
+    // adds a contact whose normal points from body a to body b. impulse is
+    // the one the contact ended the last frame with, zero for new contacts
+    void add(int a, float inversemassa, int b, float inversemassb, const vec2& normal, float d, float impulse) {
+      body1.push_back(a);
+      body2.push_back(b);
+      inversemass1.push_back(inversemassa);
+      inversemass2.push_back(inversemassb);
+      nx.push_back(normal.x);
+      ny.push_back(normal.y);
+      depth.push_back(d);
+      impulses.push_back(impulse);
+    }
+    
+    // accumulated impulse of a contact, to warm start it next frame
+    float impulse(int c) const {
+      return impulses[c];
+    }
+    
+    // computes the effective masses and the target speeds, then applies
+    // the warm start impulses. restitution is taken from the speeds the
+    // bodies approach with before any impulse
+    void prepare(float dt, float restitution, std::vector<vec2>& velocities) {
+      int n = size();
+      mass.resize(n);
+      bias.resize(n);
+      float correction = dt > 0 ? baumgarte/dt : 0;
+      for (int c = 0; c < n; c++) {
+        mass[c] = 1/(inversemass1[c] + inversemass2[c]);
+        
+        vec2 normal(nx[c], ny[c]);
+        float approach = (velocities[body2[c]] - velocities[body1[c]]).dot(normal);
+        float bounce = approach < 0 ? -restitution*approach : 0;
+        bias[c] = std::max(bounce, correction*std::max(depth[c] - slop, 0.0f));
+        
+        apply(c, impulses[c], velocities);
+      }
+    }
+    
+    // runs the iterations over all contacts
+    void solve(int iterations, std::vector<vec2>& velocities) {
+      int n = size();
+      for (int iteration = 0; iteration < iterations; iteration++) {
+        for (int c = 0; c < n; c++) {
+          vec2 normal(nx[c], ny[c]);
+          float speed = (velocities[body2[c]] - velocities[body1[c]]).dot(normal);
+          float accumulated = std::max(impulses[c] + mass[c]*(bias[c] - speed), 0.0f);
+          apply(c, accumulated - impulses[c], velocities);
+          impulses[c] = accumulated;
+        }
+      }
+    }
+    
+  private:
+    void apply(int c, float lambda, std::vector<vec2>& velocities) {
+      vec2 p(nx[c]*lambda, ny[c]*lambda);
+      velocities[body1[c]] -= p*inversemass1[c];
+      velocities[body2[c]] += p*inversemass2[c];
+    }
+};
+
+#endif
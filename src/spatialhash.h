@@ -0,0 +1,197 @@
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "broadphase.h"
+
+// uniform grid broadphase. every frame each shape is bucketed in all the
+// cells its box covers and only shapes sharing a cell are tested. the grid
+// is unbounded: cells are hashed into a table that is rebuilt with a counting
+// sort each frame, so no memory is allocated once the buffers have grown.
+// works best when shapes have similar sizes, close to the cell size.
+class spatialhash : public broadphase {
+  private:
+    struct proxy {
+      shape* sh;
+      aabb box;
+    };
+    
+    struct entry {
+      int cx, cy;
+      int proxy;
+    };
+    
+    float cellsize;
+    
+    std::vector<proxy> proxies;
+    std::vector<int> freeproxies;
+    
+    // cell entries of the frame, in insertion and in bucket order
+    std::vector<entry> scratch;
+    std::vector<entry> entries;
+    
+    // bucket i holds entries[buckets[i]] up to entries[buckets[i + 1]]
+    std::vector<int> buckets;
+    
+    // proxies inserted since the last collect, which are in no bucket yet
+    std::vector<int> fresh;
+    
+    // query of the last visit of each proxy, so shapes spanning many cells
+    // are reported once
+    std::vector<unsigned int> visits;
+    unsigned int visit;
+    
+  public:
+    spatialhash(float cellsize)
+    : cellsize(cellsize), visit(0)
+    {
+    }
+    
+    virtual void insert(shape* sh, const aabb& box) {
+      int p;
+      if (freeproxies.size()) {
+        p = freeproxies.back();
+        freeproxies.pop_back();
+      } else {
+        p = proxies.size();
+        proxies.push_back(proxy());
+      }
+      proxies[p].sh = sh;
+      proxies[p].box = box;
+      sh->proxy = p;
+      fresh.push_back(p);
+    }
+    
+    virtual void remove(shape* sh) {
+      proxies[sh->proxy].sh = 0;
+      freeproxies.push_back(sh->proxy);
+      sh->proxy = -1;
+    }
+    
+    virtual void move(shape* sh, const aabb& box, const vec2&) {
+      proxies[sh->proxy].box = box;
+    }
+    
+    virtual void collect(pairlist& pairs) {
+      // buckets every shape in the cells covered by its box
+      fresh.clear();
+      scratch.clear();
+      for (size_t p = 0; p < proxies.size(); p++) {
+        if (!proxies[p].sh)
+          continue;
+        
+        const aabb& box = proxies[p].box;
+        int cx0 = cell(box.xmin), cx1 = cell(box.xmax);
+        int cy0 = cell(box.ymin), cy1 = cell(box.ymax);
+        for (int cy = cy0; cy <= cy1; cy++) {
+          for (int cx = cx0; cx <= cx1; cx++) {
+            entry e;
+            e.cx = cx;
+            e.cy = cy;
+            e.proxy = p;
+            scratch.push_back(e);
+          }
+        }
+      }
+      
+      // counting sort of the entries by bucket
+      unsigned int tablesize = 16;
+      while (tablesize < scratch.size()*2)
+        tablesize *= 2;
+      
+      buckets.assign(tablesize + 1, 0);
+      for (size_t i = 0; i < scratch.size(); i++)
+        buckets[bucket(scratch[i], tablesize) + 1]++;
+      for (unsigned int i = 0; i < tablesize; i++)
+        buckets[i + 1] += buckets[i];
+      
+      entries.resize(scratch.size());
+      for (size_t i = 0; i < scratch.size(); i++)
+        entries[buckets[bucket(scratch[i], tablesize)]++] = scratch[i];
+      
+      // the fill above moved every start to the next bucket start
+      for (unsigned int i = tablesize; i > 0; i--)
+        buckets[i] = buckets[i - 1];
+      buckets[0] = 0;
+      
+      // tests only the shapes that share a cell. different cells may share
+      // a bucket, so the cell coordinates are compared too
+      for (unsigned int b = 0; b < tablesize; b++) {
+        for (int i = buckets[b]; i < buckets[b + 1]; i++) {
+          for (int j = i + 1; j < buckets[b + 1]; j++) {
+            const entry& e1 = entries[i];
+            const entry& e2 = entries[j];
+            if (e1.cx != e2.cx || e1.cy != e2.cy || e1.proxy == e2.proxy)
+              continue;
+            
+            const proxy& p1 = proxies[e1.proxy];
+            const proxy& p2 = proxies[e2.proxy];
+            if (!p1.sh->interacts(p2.sh) || !p1.box.overlaps(p2.box))
+              continue;
+            
+            // a pair sharing many cells is reported only by the cell that
+            // holds the corner of the intersection of both boxes
+            if (cell(std::max(p1.box.xmin, p2.box.xmin)) != e1.cx ||
+                cell(std::max(p1.box.ymin, p2.box.ymin)) != e1.cy)
+              continue;
+            
+            pairs.push_back(std::make_pair(p1.sh, p2.sh));
+          }
+        }
+      }
+    }
+    
+    // visits the buckets of the cells the box covers. boxes covering more
+    // cells than there are shapes scan the proxies instead
+    virtual void query(const aabb& box, std::vector<shape*>& found) {
+      visits.resize(proxies.size(), visit);
+      visit++;
+      
+      int cx0 = cell(box.xmin), cx1 = cell(box.xmax);
+      int cy0 = cell(box.ymin), cy1 = cell(box.ymax);
+      double cells = (double)(cx1 - cx0 + 1)*(cy1 - cy0 + 1);
+      if (buckets.empty() || cells > proxies.size()) {
+        for (size_t p = 0; p < proxies.size(); p++)
+          report(p, box, found);
+        return;
+      }
+      
+      unsigned int tablesize = buckets.size() - 1;
+      for (int cy = cy0; cy <= cy1; cy++) {
+        for (int cx = cx0; cx <= cx1; cx++) {
+          entry e;
+          e.cx = cx;
+          e.cy = cy;
+          unsigned int b = bucket(e, tablesize);
+          for (int i = buckets[b]; i < buckets[b + 1]; i++) {
+            if (entries[i].cx == cx && entries[i].cy == cy)
+              report(entries[i].proxy, box, found);
+          }
+        }
+      }
+      for (size_t i = 0; i < fresh.size(); i++)
+        report(fresh[i], box, found);
+    }
+    
+  private:
+    // appends the shape of a proxy to found on its first visit of the query
+    void report(int p, const aabb& box, std::vector<shape*>& found) {
+      if (visits[p] == visit || !proxies[p].sh)
+        return;
+      visits[p] = visit;
+      if (proxies[p].box.overlaps(box))
+        found.push_back(proxies[p].sh);
+    }
+    
+    int cell(float coordinate) const {
+      return (int)std::floor(coordinate/cellsize);
+    }
+    
+    static unsigned int bucket(const entry& e, unsigned int tablesize) {
+      return (((unsigned int)e.cx*73856093u) ^ ((unsigned int)e.cy*19349663u)) & (tablesize - 1);
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include "shapes.h"
+
+// profiling counters of one collider frame. the counts cost an increment
+// each and are always taken. the stage clock and the publishing only run
+// while some collider asks for the stats.
+struct collisionstats {
+  // stages of the frame, timed in nanoseconds
+  enum stage {
+    snapshot,     // kinematic snapshots and sleep
+    broadphase,   // moving the shapes and collecting the pairs
+    narrowphase,  // pair cache lookups and collision tests
+    response,     // contact impulses, when the response is on
+    events,       // dropping stale pairs and publishing the events
+    total,
+    stages
+  };
+  
+  // pairs reported by the broadphase and the resting tree
+  int candidates;
+  
+  // distinct pairs handled in the frame, and those served by the cache
+  int pairs;
+  int cached;
+  
+  // narrowphase tests by pair of shape types, lower type first
+  int tests[shapetypes::size][shapetypes::size];
+  
+  // pairs touching at the end of the frame
+  int hits;
+  
+  // contacts solved by the response
+  int contacts;
+  
+  // shapes created and freed since the last frame
+  int added;
+  int removed;
+  
+  int times[stages];
+  
+  collisionstats() {
+    clear();
+  }
+  
+  void clear() {
+    candidates = pairs = cached = hits = contacts = added = removed = 0;
+    for (int a = 0; a < shapetypes::size; a++) {
+      for (int b = 0; b < shapetypes::size; b++)
+        tests[a][b] = 0;
+    }
+    for (int s = 0; s < stages; s++)
+      times[s] = 0;
+  }
+  
+  static const char* stagename(int s) {
+    static const char* names[stages] = { "snapshot", "broadphase", "narrowphase", "response", "events", "total" };
+    return names[s];
+  }
+  
+  // names of the published values, relative to collider.stats., and the
+  // values themselves in the same order
+  static void names(std::vector<std::string>& out) {
+    out.push_back("candidates");
+    out.push_back("pairs");
+    out.push_back("cached");
+    out.push_back("hits");
+    out.push_back("contacts");
+    out.push_back("added");
+    out.push_back("removed");
+    for (int a = 0; a < shapetypes::size; a++) {
+      for (int b = a; b < shapetypes::size; b++)
+        out.push_back(std::string("tests.") + shapenames[a] + "." + shapenames[b]);
+    }
+    for (int s = 0; s < stages; s++)
+      out.push_back(std::string("time.") + stagename(s));
+  }
+  
+  void values(std::vector<int>& out) const {
+    out.push_back(candidates);
+    out.push_back(pairs);
+    out.push_back(cached);
+    out.push_back(hits);
+    out.push_back(contacts);
+    out.push_back(added);
+    out.push_back(removed);
+    for (int a = 0; a < shapetypes::size; a++) {
+      for (int b = a; b < shapetypes::size; b++)
+        out.push_back(tests[a][b]);
+    }
+    for (int s = 0; s < stages; s++)
+      out.push_back(times[s]);
+  }
+};
+
+// adds to the stage times the time elapsed since the last lap
+class stageclock {
+  private:
+    typedef std::chrono::steady_clock clock;
+    clock::time_point last;
+    
+  public:
+    void start() {
+      last = clock::now();
+    }
+    
+    void lap(collisionstats& stats, collisionstats::stage s) {
+      clock::time_point now = clock::now();
+      stats.times[s] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+      last = now;
+    }
+};
+
+// rolling histograms of the stage times over the last frames, in buckets
+// of powers of two microseconds. every period frames the histograms of the
+// window are appended to a file, one line per stage:
+//   <frame> <stage> <frames under 1us> <under 2us> <under 4us> ...
+class statshistogram {
+  private:
+    static const int buckets = 24;
+    
+    std::ofstream file;
+    int window;
+    int period;
+    
+    // bucket of every stage in the frames of the window, as a ring
+    std::vector<unsigned char> ring;
+    int next;
+    int filled;
+    int sincedump;
+    
+    int counts[collisionstats::stages][buckets];
+    
+  public:
+    statshistogram()
+    : window(0), period(0), next(0), filled(0), sincedump(0)
+    {
+    }
+    
+    bool active() const {
+      return file.is_open();
+    }
+    
+    // starts appending to path. returns false if the file can't be opened
+    bool open(const std::string& path, int window, int period) {
+      file.open(path.c_str(), std::ios::out | std::ios::app);
+      if (!file)
+        return false;
+      this->window = std::max(window, 1);
+      this->period = std::max(period, 1);
+      ring.assign(this->window*collisionstats::stages, 0);
+      next = filled = sincedump = 0;
+      for (int s = 0; s < collisionstats::stages; s++) {
+        for (int b = 0; b < buckets; b++)
+          counts[s][b] = 0;
+      }
+      return true;
+    }
+    
+    void add(const collisionstats& stats, int frame) {
+      unsigned char* slot = &ring[next*collisionstats::stages];
+      for (int s = 0; s < collisionstats::stages; s++) {
+        if (filled == window)
+          counts[s][slot[s]]--;
+        slot[s] = bucket(stats.times[s]);
+        counts[s][slot[s]]++;
+      }
+      next = (next + 1) % window;
+      filled = std::min(filled + 1, window);
+      
+      if (++sincedump < period)
+        return;
+      sincedump = 0;
+      for (int s = 0; s < collisionstats::stages; s++) {
+        file << frame << ' ' << collisionstats::stagename(s);
+        for (int b = 0; b < buckets; b++)
+          file << ' ' << counts[s][b];
+        file << '\n';
+      }
+      file.flush();
+    }
+    
+  private:
+    // bucket b holds the times under 2^b microseconds
+    static unsigned char bucket(int nanoseconds) {
+      unsigned int micro = nanoseconds/1000;
+      unsigned char b = 0;
+      while (micro && b < buckets - 1) {
+        micro >>= 1;
+        b++;
+      }
+      return b;
+    }
+};
+
+#endif
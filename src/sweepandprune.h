@@ -0,0 +1,449 @@
+#ifndef SWEEPANDPRUNE_H
+#define SWEEPANDPRUNE_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "broadphase.h"
+#include "pairtable.h"
+#include "pool.h"
+
+// sweep and prune broadphase. keeps, for each axis, the list of the box
+// endpoints of every shape sorted by coordinate. as objects move little
+// between frames the lists are almost sorted, so insertion sort refreshes
+// them in nearly linear time. every swap between the endpoints of two
+// different boxes is exactly the moment their intervals start or stop
+// overlapping on that axis, which keeps the set of overlapping pairs
+// up to date without testing all pairs.
+//
+// new shapes wait until the next sort, and are then searched into the
+// sorted lists one by one. when many arrive at once, as when a level is
+// loaded, the lists are sorted and the pairs found in a single sweep
+// instead.
+//
+// every proxy knows where its endpoints are and which pairs it is in, so
+// removing it touches only those. its endpoints are left in the lists,
+// marked as removed, until the next sort drops them.
+class sweepandprune : public broadphase {
+  private:
+    // pair of proxies whose boxes overlap, listed by both proxies
+    struct overlap {
+      int proxy1, proxy2;
+      
+      // positions of the pair in the lists of both proxies
+      int slot1, slot2;
+    };
+    
+    struct proxy {
+      shape* sh;
+      aabb box;
+      
+      // place of the proxy in pending, -1 once its endpoints are listed
+      int waiting;
+      
+      // places of the min and max endpoints in the list of each axis
+      int ends[2][2];
+      
+      std::vector<overlap*> overlaps;
+    };
+    
+    struct endpoint {
+      float value;
+      int proxy;
+      bool max;
+    };
+    
+    std::vector<proxy> proxies;
+    std::vector<int> freeproxies;
+    std::vector<endpoint> axes[2];
+    
+    // proxies inserted since the last sort, and how many of them are
+    // searched into the lists one by one before a full rebuild is cheaper
+    std::vector<int> pending;
+    static const size_t rebuildlimit = 16;
+    
+    // whether boxes moved or proxies came and went since the last sort,
+    // and whether removed endpoints wait in the lists
+    bool dirty;
+    bool removed;
+    
+    // pairs of proxies whose boxes overlap, keyed by both proxies
+    pairtable<overlap> overlaps;
+    pool<overlap> overlappool;
+    
+    // widest box on the x axis as of the last sort, so a query knows how
+    // far left of its box the min endpoint of an overlapping box can be
+    double widest;
+    
+    // scratch of the ray batches: the box and the x endpoints of every ray,
+    // and the proxies and rays crossing the sweep line with their slots
+    std::vector<aabb> rayboxes;
+    std::vector<endpoint> rayendpoints;
+    std::vector<int> activeproxies, activerays;
+    std::vector<int> proxyslots, rayslots;
+    
+  public:
+    sweepandprune()
+    : dirty(false), removed(false), widest(0)
+    {
+    }
+    
+    virtual void insert(shape* sh, const aabb& box) {
+      int p;
+      if (freeproxies.size()) {
+        p = freeproxies.back();
+        freeproxies.pop_back();
+      } else {
+        p = proxies.size();
+        proxies.push_back(proxy());
+      }
+      proxies[p].sh = sh;
+      proxies[p].box = box;
+      proxies[p].waiting = pending.size();
+      pending.push_back(p);
+      sh->proxy = p;
+      dirty = true;
+    }
+    
+    virtual void remove(shape* sh) {
+      int p = sh->proxy;
+      sh->proxy = -1;
+      proxies[p].sh = 0;
+      freeproxies.push_back(p);
+      if (proxies[p].waiting >= 0) {
+        int last = pending.back();
+        pending[proxies[p].waiting] = last;
+        proxies[last].waiting = proxies[p].waiting;
+        pending.pop_back();
+        return;
+      }
+      
+      while (proxies[p].overlaps.size())
+        unlink(proxies[p].overlaps.back());
+      for (int axis = 0; axis < 2; axis++) {
+        axes[axis][proxies[p].ends[axis][0]].proxy = -1;
+        axes[axis][proxies[p].ends[axis][1]].proxy = -1;
+      }
+      removed = true;
+      dirty = true;
+    }
+    
+    virtual void move(shape* sh, const aabb& box, const vec2&) {
+      proxies[sh->proxy].box = box;
+      dirty = true;
+    }
+    
+    virtual void collect(pairlist& pairs) {
+      refresh();
+      for (size_t i = 0; i < overlaps.size(); i++)
+        pairs.push_back(std::make_pair(proxies[overlaps[i]->proxy1].sh, proxies[overlaps[i]->proxy2].sh));
+    }
+    
+    // binary searches the sorted x endpoints for the first min endpoint
+    // that can belong to a box reaching box, then tests the boxes whose min
+    // endpoint lies between there and the right of box
+    virtual void query(const aabb& box, std::vector<shape*>& found) {
+      refresh();
+      const std::vector<endpoint>& list = axes[0];
+      double from = box.xmin - widest;
+      std::vector<endpoint>::const_iterator it = std::lower_bound(list.begin(), list.end(), from, below);
+      for (; it != list.end() && it->value <= box.xmax; ++it) {
+        if (!it->max && proxies[it->proxy].box.overlaps(box))
+          found.push_back(proxies[it->proxy].sh);
+      }
+    }
+    
+    // sweeps the x endpoints of the boxes and of the rays together once for
+    // the whole batch. a box starting is tested against the rays the sweep
+    // line crosses, and a ray starting against the boxes it crosses
+    virtual void raycast(const ray* rays, int count, std::vector< std::pair<int, shape*> >& found) {
+      if (!count)
+        return;
+      refresh();
+      
+      rayboxes.resize(count);
+      rayendpoints.clear();
+      for (int i = 0; i < count; i++) {
+        const vec2& from = rays[i].from;
+        const vec2& to = rays[i].to;
+        rayboxes[i] = aabb(std::min(from.x, to.x), std::min(from.y, to.y), std::max(from.x, to.x), std::max(from.y, to.y));
+        endpoint e;
+        e.proxy = i;
+        e.max = false;
+        e.value = rayboxes[i].xmin;
+        rayendpoints.push_back(e);
+        e.max = true;
+        e.value = rayboxes[i].xmax;
+        rayendpoints.push_back(e);
+      }
+      std::sort(rayendpoints.begin(), rayendpoints.end(), before);
+      
+      const std::vector<endpoint>& list = axes[0];
+      activeproxies.clear();
+      activerays.clear();
+      proxyslots.resize(proxies.size());
+      rayslots.resize(count);
+      
+      // on ties mins come first, so touching boxes are still crossed
+      size_t b = 0, r = 0;
+      while (b < list.size() && r < rayendpoints.size()) {
+        if (before(rayendpoints[r], list[b])) {
+          const endpoint& e = rayendpoints[r++];
+          if (e.max) {
+            leave(activerays, rayslots, e.proxy);
+            continue;
+          }
+          for (size_t k = 0; k < activeproxies.size(); k++)
+            cross(rays, e.proxy, activeproxies[k], found);
+          enter(activerays, rayslots, e.proxy);
+        } else {
+          const endpoint& e = list[b++];
+          if (e.max) {
+            leave(activeproxies, proxyslots, e.proxy);
+            continue;
+          }
+          for (size_t k = 0; k < activerays.size(); k++)
+            cross(rays, activerays[k], e.proxy, found);
+          enter(activeproxies, proxyslots, e.proxy);
+        }
+      }
+    }
+    
+  private:
+    static float coordinate(const aabb& box, int axis, bool max) {
+      if (axis == 0)
+        return max ? box.xmax : box.xmin;
+      return max ? box.ymax : box.ymin;
+    }
+    
+    // strict ordering of the endpoints. on ties a min comes before a max,
+    // so touching boxes are reported just as the narrowphase sees them
+    static bool before(const endpoint& a, const endpoint& b) {
+      return (a.value < b.value || (a.value == b.value && !a.max && b.max));
+    }
+    
+    static bool below(const endpoint& e, double value) {
+      return e.value < value;
+    }
+    
+    void addpair(int a, int b) {
+      if (a == b || !proxies[a].sh->interacts(proxies[b].sh))
+        return;
+      if (!proxies[a].box.overlaps(proxies[b].box))
+        return;
+      uint64_t key = pairtable<overlap>::key(a, b);
+      if (overlaps.find(key))
+        return;
+      
+      overlap* o = overlappool.create();
+      o->proxy1 = std::min(a, b);
+      o->proxy2 = std::max(a, b);
+      o->slot1 = proxies[o->proxy1].overlaps.size();
+      proxies[o->proxy1].overlaps.push_back(o);
+      o->slot2 = proxies[o->proxy2].overlaps.size();
+      proxies[o->proxy2].overlaps.push_back(o);
+      overlaps.insert(key, o);
+    }
+    
+    void removepair(int a, int b) {
+      overlap* o = overlaps.find(pairtable<overlap>::key(a, b));
+      if (o)
+        unlink(o);
+    }
+    
+    // removes a pair from the index and from the lists of its proxies
+    void unlink(overlap* o) {
+      overlaps.erase(pairtable<overlap>::key(o->proxy1, o->proxy2));
+      detach(o->proxy1, o->slot1);
+      detach(o->proxy2, o->slot2);
+      overlappool.destroy(o);
+    }
+    
+    // takes the pair at a slot out of the list of a proxy, moving the last
+    // pair of the list there
+    void detach(int p, int slot) {
+      std::vector<overlap*>& list = proxies[p].overlaps;
+      overlap* last = list.back();
+      list[slot] = last;
+      if (last->proxy1 == p)
+        last->slot1 = slot;
+      else
+        last->slot2 = slot;
+      list.pop_back();
+    }
+    
+    // reports proxy p if ray i crosses its box
+    void cross(const ray* rays, int i, int p, std::vector< std::pair<int, shape*> >& found) {
+      const aabb& box = proxies[p].box;
+      float t;
+      vec2 normal;
+      if (box.overlaps(rayboxes[i]) && box.raycast(rays[i].from, rays[i].to, t, normal))
+        found.push_back(std::make_pair(i, proxies[p].sh));
+    }
+    
+    // adds and removes in constant time an index of the sweep line, whose
+    // place in active is kept in slots
+    static void enter(std::vector<int>& active, std::vector<int>& slots, int index) {
+      slots[index] = active.size();
+      active.push_back(index);
+    }
+    
+    static void leave(std::vector<int>& active, std::vector<int>& slots, int index) {
+      int last = active.back();
+      active[slots[index]] = last;
+      slots[last] = slots[index];
+      active.pop_back();
+    }
+    
+    // brings the lists up to date with the boxes, then lists the pending
+    // proxies
+    void refresh() {
+      if (!dirty)
+        return;
+      dirty = false;
+      if (removed) {
+        compact(0);
+        compact(1);
+        removed = false;
+      }
+      sortaxis(0);
+      sortaxis(1);
+      
+      // in double, where the width of two floats apart is exact
+      widest = 0;
+      for (size_t p = 0; p < proxies.size(); p++) {
+        if (proxies[p].sh && proxies[p].waiting < 0)
+          widest = std::max(widest, width(proxies[p].box));
+      }
+      
+      if (pending.size() > rebuildlimit)
+        rebuild();
+      else {
+        for (size_t i = 0; i < pending.size(); i++)
+          place(pending[i]);
+      }
+      for (size_t i = 0; i < pending.size(); i++)
+        proxies[pending[i]].waiting = -1;
+      pending.clear();
+    }
+    
+    static double width(const aabb& box) {
+      return (double)box.xmax - box.xmin;
+    }
+    
+    // searches the endpoints of a proxy into the sorted lists and pairs it
+    // with the boxes its own box overlaps
+    void place(int p) {
+      const aabb& box = proxies[p].box;
+      for (int axis = 0; axis < 2; axis++) {
+        std::vector<endpoint>& list = axes[axis];
+        endpoint e;
+        e.proxy = p;
+        for (int m = 0; m < 2; m++) {
+          e.max = m;
+          e.value = coordinate(box, axis, e.max);
+          std::vector<endpoint>::iterator at = list.insert(std::lower_bound(list.begin(), list.end(), e, before), e);
+          relist(axis, at - list.begin());
+        }
+      }
+      widest = std::max(widest, width(box));
+      
+      const std::vector<endpoint>& list = axes[0];
+      double from = box.xmin - widest;
+      std::vector<endpoint>::const_iterator it = std::lower_bound(list.begin(), list.end(), from, below);
+      for (; it != list.end() && it->value <= box.xmax; ++it) {
+        if (!it->max)
+          addpair(p, it->proxy);
+      }
+    }
+    
+    // appends the endpoints of all pending proxies, sorts the lists and
+    // finds every pair again by sweeping the x axis
+    void rebuild() {
+      for (size_t i = 0; i < pending.size(); i++) {
+        int p = pending[i];
+        widest = std::max(widest, width(proxies[p].box));
+        for (int axis = 0; axis < 2; axis++) {
+          endpoint e;
+          e.proxy = p;
+          for (int m = 0; m < 2; m++) {
+            e.max = m;
+            e.value = coordinate(proxies[p].box, axis, e.max);
+            axes[axis].push_back(e);
+          }
+        }
+      }
+      std::sort(axes[0].begin(), axes[0].end(), before);
+      std::sort(axes[1].begin(), axes[1].end(), before);
+      relist(0, 0);
+      relist(1, 0);
+      
+      // the boxes crossing the sweep line overlap on x the box starting,
+      // the full box test does the rest
+      while (overlaps.size())
+        unlink(overlaps[overlaps.size() - 1]);
+      activeproxies.clear();
+      proxyslots.resize(proxies.size());
+      const std::vector<endpoint>& list = axes[0];
+      for (size_t i = 0; i < list.size(); i++) {
+        const endpoint& e = list[i];
+        if (e.max) {
+          leave(activeproxies, proxyslots, e.proxy);
+          continue;
+        }
+        for (size_t k = 0; k < activeproxies.size(); k++)
+          addpair(e.proxy, activeproxies[k]);
+        enter(activeproxies, proxyslots, e.proxy);
+      }
+    }
+    
+    // records the places of the endpoints of an axis list from first on
+    void relist(int axis, size_t first) {
+      const std::vector<endpoint>& list = axes[axis];
+      for (size_t i = first; i < list.size(); i++)
+        proxies[list[i].proxy].ends[axis][list[i].max] = i;
+    }
+    
+    // drops the endpoints of the removed proxies from an axis list
+    void compact(int axis) {
+      std::vector<endpoint>& list = axes[axis];
+      size_t kept = 0;
+      for (size_t i = 0; i < list.size(); i++) {
+        if (list[i].proxy >= 0)
+          list[kept++] = list[i];
+      }
+      list.resize(kept);
+      relist(axis, 0);
+    }
+    
+    // refreshes the endpoint values and insertion sorts the axis list
+    void sortaxis(int axis) {
+      std::vector<endpoint>& list = axes[axis];
+      for (size_t i = 0; i < list.size(); i++)
+        list[i].value = coordinate(proxies[list[i].proxy].box, axis, list[i].max);
+      
+      for (size_t i = 1; i < list.size(); i++) {
+        endpoint moving = list[i];
+        size_t j = i;
+        while (j > 0 && before(moving, list[j - 1])) {
+          const endpoint& passed = list[j - 1];
+          
+          // a min going left of a max may start an overlap, which is
+          // confirmed against the other axis by the full box test. a max
+          // going left of a min ends the overlap on this axis.
+          if (!moving.max && passed.max)
+            addpair(moving.proxy, passed.proxy);
+          else if (moving.max && !passed.max)
+            removepair(moving.proxy, passed.proxy);
+          
+          list[j] = list[j - 1];
+          proxies[list[j].proxy].ends[axis][list[j].max] = j;
+          j--;
+        }
+        list[j] = moving;
+        proxies[moving.proxy].ends[axis][moving.max] = j;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef TOI_H
+#define TOI_H
+
+#include <cmath>
+#include <algorithm>
+#include "linearalgebra.h"
+
+// time of impact solvers for shapes under quadratic motion. the motion of
+// the first shape relative to the second is d + v*t + a*t*t/2, as getpos
+// models it, and every solver returns whether the shapes touch inside
+// [0, dt] and the earliest time they do.
+//
+// the contact conditions are polynomial in t: quadratic for the boxes
+// sides and quartic for squared distances. quadratics are solved in closed
+// form, higher degrees by isolating the roots between the roots of the
+// derivative, where the polynomial is monotonic, and refining each of them
+// inside its bracket.
+
+// tolerance used when checking a candidate time of impact, in world units
+const double toi_slack = 1e-3;
+
+// value of the polynomial c[0] + c[1]*t + ... + c[degree]*t^degree
+inline double polyeval(const double* c, int degree, double t) {
+  double value = c[degree];
+  for (int i = degree - 1; i >= 0; i--)
+    value = value*t + c[i];
+  return value;
+}
+
+// sorts the few candidate times of a test in increasing order
+inline void sorttimes(double* times, int count) {
+  for (int i = 1; i < count; i++) {
+    double t = times[i];
+    int j = i;
+    for (; j > 0 && times[j - 1] > t; j--)
+      times[j] = times[j - 1];
+    times[j] = t;
+  }
+}
+
+// finds the real roots of the polynomial inside [t0, t1], writing them in
+// increasing order to roots. returns how many were found, up to degree.
+inline int polyroots(const double* c, int degree, double t0, double t1, double* roots) {
+  // ignores vanishing leading coefficients
+  double scale = 0;
+  for (int i = 0; i <= degree; i++)
+    scale = std::max(scale, std::fabs(c[i]));
+  while (degree > 0 && std::fabs(c[degree]) <= scale*1e-12)
+    degree--;
+  
+  int count = 0;
+  if (degree == 0)
+    return 0;
+  
+  if (degree == 1) {
+    double t = -c[0]/c[1];
+    if (t >= t0 && t <= t1)
+      roots[count++] = t;
+    return count;
+  }
+  
+  if (degree == 2) {
+    double delta = c[1]*c[1] - 4*c[2]*c[0];
+    if (delta < 0)
+      return 0;
+    
+    // numerically stable form of the quadratic formula
+    double q = -0.5*(c[1] + (c[1] < 0 ? -std::sqrt(delta) : std::sqrt(delta)));
+    double r1 = q/c[2];
+    double r2 = q ? c[0]/q : r1;
+    if (r1 > r2)
+      std::swap(r1, r2);
+    if (r1 >= t0 && r1 <= t1)
+      roots[count++] = r1;
+    if (r2 >= t0 && r2 <= t1 && r2 != r1)
+      roots[count++] = r2;
+    return count;
+  }
+  
+  // the roots of the derivative split the interval in monotonic pieces,
+  // each holding at most one root
+  double derivative[4];
+  for (int i = 0; i < degree; i++)
+    derivative[i] = (i + 1)*c[i + 1];
+  
+  double breaks[5];
+  int pieces = polyroots(derivative, degree - 1, t0, t1, breaks + 1);
+  breaks[0] = t0;
+  breaks[pieces + 1] = t1;
+  
+  for (int i = 0; i <= pieces; i++) {
+    double lo = breaks[i], hi = breaks[i + 1];
+    double flo = polyeval(c, degree, lo), fhi = polyeval(c, degree, hi);
+    
+    if (flo == 0) {
+      if (!count || roots[count - 1] != lo)
+        roots[count++] = lo;
+      continue;
+    }
+    if (fhi == 0 || (flo < 0) == (fhi < 0))
+      continue;
+    
+    // bisection keeps the bracket, 60 halvings exhaust a double
+    for (int k = 0; k < 60; k++) {
+      double mid = 0.5*(lo + hi);
+      double fmid = polyeval(c, degree, mid);
+      if ((fmid < 0) == (flo < 0)) {
+        lo = mid;
+        flo = fmid;
+      } else
+        hi = mid;
+    }
+    roots[count++] = 0.5*(lo + hi);
+  }
+  
+  if (polyeval(c, degree, t1) == 0 && (!count || roots[count - 1] != t1))
+    roots[count++] = t1;
+  return count;
+}
+
+// appends to times the instants in [0, dt] where the coordinate
+// p + v*t + a*t*t/2 equals value
+inline int toicrossings(double p, double v, double a, double value, double dt, double* times) {
+  double c[3] = { p - value, v, 0.5*a };
+  return polyroots(c, 2, 0, dt, times);
+}
+
+// appends to times the instants in [0, dt] where the distance from the point
+// p + v*t + a*t*t/2 to the origin equals r
+inline int toidistance(const vec2& p, const vec2& v, const vec2& a, double r, double dt, double* times) {
+  // |p + v*t + a*t*t/2|^2 - r^2 expanded in powers of t
+  double px = p.x, py = p.y, vx = v.x, vy = v.y, ax = 0.5*a.x, ay = 0.5*a.y;
+  double c[5] = {
+    px*px + py*py - r*r,
+    2*(px*vx + py*vy),
+    vx*vx + vy*vy + 2*(px*ax + py*ay),
+    2*(vx*ax + vy*ay),
+    ax*ax + ay*ay
+  };
+  return polyroots(c, 4, 0, dt, times);
+}
+
+// circles whose radii sum r. d is the center of the first minus the center
+// of the second.
+inline bool toicircles(
+  const vec2& d, const vec2& v, const vec2& a, float r,
+  float dt, float& toi
+) {
+  if (d.length_sq() <= r*r) {
+    toi = 0;
+    return true;
+  }
+  
+  // the circles start apart, so the first root is when they touch
+  double times[4];
+  if (!toidistance(d, v, a, r, dt, times))
+    return false;
+  toi = times[0];
+  return true;
+}
+
+// axis aligned boxes of sizes aw x ah and bw x bh. d is the upper left
+// corner of the first minus the upper left corner of the second.
+inline bool toirectangles(
+  const vec2& d, const vec2& v, const vec2& a,
+  float aw, float ah, float bw, float bh,
+  float dt, float& toi
+) {
+  // the boxes overlap while -aw <= x(t) <= bw and -ah <= y(t) <= bh. the
+  // overlap starts at 0 or when one of the sides is crossed.
+  double times[9];
+  int count = 0;
+  times[count++] = 0;
+  count += toicrossings(d.x, v.x, a.x, -aw, dt, times + count);
+  count += toicrossings(d.x, v.x, a.x, bw, dt, times + count);
+  count += toicrossings(d.y, v.y, a.y, -ah, dt, times + count);
+  count += toicrossings(d.y, v.y, a.y, bh, dt, times + count);
+  sorttimes(times, count);
+  
+  for (int i = 0; i < count; i++) {
+    vec2 p = motion(d, v, a, times[i]);
+    if (
+      p.x >= -aw - toi_slack && p.x <= bw + toi_slack &&
+      p.y >= -ah - toi_slack && p.y <= bh + toi_slack
+    ) {
+      toi = times[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// axis aligned box of size w x h and circle of radius r. d is the center of
+// the circle minus the upper left corner of the box.
+inline bool toirectanglecircle(
+  const vec2& d, const vec2& v, const vec2& a,
+  float w, float h, float r,
+  float dt, float& toi
+) {
+  // the center touches the box grown by r, whose border is made of the box
+  // sides pushed out by r and of arcs around the box corners. the contact
+  // starts at 0 or when the center crosses one of those.
+  double times[1 + 4*2 + 4*4];
+  int count = 0;
+  times[count++] = 0;
+  count += toicrossings(d.x, v.x, a.x, -r, dt, times + count);
+  count += toicrossings(d.x, v.x, a.x, w + r, dt, times + count);
+  count += toicrossings(d.y, v.y, a.y, -r, dt, times + count);
+  count += toicrossings(d.y, v.y, a.y, h + r, dt, times + count);
+  
+  float corners[4][2] = { { 0, 0 }, { w, 0 }, { 0, h }, { w, h } };
+  for (int i = 0; i < 4; i++)
+    count += toidistance(d - vec2(corners[i][0], corners[i][1]), v, a, r, dt, times + count);
+  sorttimes(times, count);
+  
+  for (int i = 0; i < count; i++) {
+    // distance from the center to the closest point of the box
+    vec2 p = motion(d, v, a, times[i]);
+    double dx = p.x - std::min(std::max((double)p.x, 0.0), (double)w);
+    double dy = p.y - std::min(std::max((double)p.y, 0.0), (double)h);
+    if (std::sqrt(dx*dx + dy*dy) <= r + toi_slack) {
+      toi = times[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// fixed pool of worker threads that run a job over a range of items. the
+// range is cut in chunks dealt evenly to the workers, and a worker that runs
+// out of chunks steals the next ones of the others, so costly chunks don't
+// leave threads idle. the thread calling run works too, as worker 0, and run
+// only returns once every item is done.
+class workerpool {
+  public:
+    // runs the items [begin, end) on the given worker
+    typedef std::function<void(int worker, int begin, int end)> job;
+    
+  private:
+    // chunks of a worker still to run. padded so the cursors of different
+    // workers don't share a cache line
+    struct queue {
+      std::atomic<int> next;
+      int end;
+      char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+    };
+    
+    std::vector<queue> queues;
+    std::vector<std::thread> threads;
+    
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    
+    // job being run, bumped generation for every run
+    const job* current;
+    int items;
+    int chunksize;
+    int generation;
+    int busy;
+    bool stopping;
+    
+  public:
+    workerpool(int workers)
+    : queues(std::max(workers, 1)), current(0), items(0), chunksize(1),
+      generation(0), busy(0), stopping(false)
+    {
+      for (int w = 1; w < size(); w++)
+        threads.push_back(std::thread(&workerpool::loop, this, w));
+    }
+    
+    ~workerpool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    }
+    
+    // number of workers, the calling thread included
+    int size() const {
+      return queues.size();
+    }
+    
+    void run(int items, int chunksize, const job& j) {
+      int chunks = (items + chunksize - 1)/chunksize;
+      for (int w = 0; w < size(); w++) {
+        queues[w].next = chunks*w/size();
+        queues[w].end = chunks*(w + 1)/size();
+      }
+      
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = &j;
+        this->items = items;
+        this->chunksize = chunksize;
+        busy = threads.size();
+        generation++;
+      }
+      wake.notify_all();
+      
+      work(0);
+      
+      std::unique_lock<std::mutex> lock(mutex);
+      while (busy)
+        done.wait(lock);
+      current = 0;
+    }
+    
+  private:
+    void loop(int worker) {
+      int seen = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          while (!stopping && generation == seen)
+            wake.wait(lock);
+          if (stopping)
+            return;
+          seen = generation;
+        }
+        
+        work(worker);
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+          done.notify_one();
+      }
+    }
+    
+    // runs the chunks of the worker, then steals from the others
+    void work(int worker) {
+      for (int k = 0; k < size(); k++) {
+        queue& q = queues[(worker + k) % size()];
+        for (int c = q.next++; c < q.end; c = q.next++) {
+          int begin = c*chunksize;
+          (*current)(worker, begin, std::min(begin + chunksize, items));
+        }
+      }
+    }
+};
+
+#endif